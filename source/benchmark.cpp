@@ -18,12 +18,20 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <chrono>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <istream>
+#include <sstream>
 #include <vector>
 
+#include "evaluate.h"
+#include "movegen.h"
+#include "polybook.h"
 #include "position.h"
+#include "thread.h"
+#include "tt.h"
 
 using namespace std;
 
@@ -87,8 +95,140 @@ const vector<string> Defaults = {
   "setoption name UCI_Chess960 value false"
 };
 
+  // Results of the microbenchmarks go there, so that the work is not optimized away
+  volatile uint64_t Sink;
+
+  // time_ns() runs a pass of a microbenchmark the given number of times and
+  // returns the average time of one of its operations, in nanoseconds.
+  template<typename F>
+  double time_ns(int passes, uint64_t opsPerPass, F pass) {
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t sink = 0;
+
+    for (int i = 0; i < passes; ++i)
+        sink += pass();
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    Sink = sink;
+    return elapsed.count() / (double(passes) * std::max(opsPerPass, uint64_t(1)));
+  }
+
 } // namespace
 
+/// microbench() times the operations the search is built on, over the legal
+/// moves of the default bench positions, and prints the average cost of each
+/// in nanoseconds as a JSON object on one line. The parameter is the number of
+/// passes over the positions.
+///
+/// microbench -> 1000 passes
+/// microbench 10000 -> 10000 passes
+
+void microbench(istream& is) {
+
+  int passes = 1000, count;
+
+  // A count that does not parse leaves the default
+  if (is >> count)
+      passes = std::max(count, 1);
+
+  // The positions below are set up on the main thread, and TT.allocate() must
+  // not run under a search, so let any running "go" finish first.
+  Threads.main()->wait_for_search_finished();
+
+  deque<Position> positions;
+  deque<StateInfo> states;
+  bool chess960 = false;
+  uint64_t positionCnt = 0, quietCnt = 0, moveCnt = 0;
+
+  for (const string& fen : Defaults)
+      if (fen.find("setoption") != string::npos)
+          chess960 = fen.find("value true") != string::npos;
+      else
+      {
+          states.emplace_back();
+          positions.emplace_back();
+          positions.back().set(fen, chess960, &states.back(), Threads.main());
+          positionCnt++;
+          quietCnt += !positions.back().checkers();
+          moveCnt += MoveList<LEGAL>(positions.back()).size();
+      }
+
+  TT.allocate();
+
+  double doMove = time_ns(passes, moveCnt, [&]() {
+      StateInfo st;
+      for (Position& pos : positions)
+          for (const auto& m : MoveList<LEGAL>(pos))
+          {
+              pos.do_move(m, st);
+              pos.undo_move(m);
+          }
+      return uint64_t(0);
+  });
+
+  double legal = time_ns(passes, positionCnt, [&]() {
+      uint64_t n = 0;
+      for (Position& pos : positions)
+          n += MoveList<LEGAL>(pos).size();
+      return n;
+  });
+
+  double evaluate = time_ns(passes, quietCnt, [&]() {
+      uint64_t n = 0;
+      for (Position& pos : positions)
+          if (!pos.checkers())
+              n += uint64_t(Eval::evaluate(pos));
+      return n;
+  });
+
+  double ttProbe = time_ns(passes, moveCnt, [&]() {
+      uint64_t n = 0;
+      bool found;
+      for (Position& pos : positions)
+          for (const auto& m : MoveList<LEGAL>(pos))
+              n += TT.probe(pos.key_after(m), found)->depth() + found;
+      return n;
+  });
+
+  double seeGe = time_ns(passes, moveCnt, [&]() {
+      uint64_t n = 0;
+      for (Position& pos : positions)
+          for (const auto& m : MoveList<LEGAL>(pos))
+              n += pos.see_ge(m, VALUE_ZERO);
+      return n;
+  });
+
+  // The per move loops generate the moves too, their cost is taken out here
+  doMove  -= legal * positionCnt / moveCnt;
+  ttProbe -= legal * positionCnt / moveCnt;
+  seeGe   -= legal * positionCnt / moveCnt;
+
+  double book = time_ns(passes, positionCnt, [&]() {
+      uint64_t n = 0;
+      for (Position& pos : positions)
+          n += polybook.in_book(pos);
+      return n;
+  });
+
+  stringstream ss;
+  ss.precision(1);
+  ss << fixed
+     << "{\"passes\":"      << passes
+     << ",\"positions\":"   << positionCnt
+     << ",\"moves\":"       << moveCnt
+     << ",\"ns_per_op\":{"
+     << "\"do_move\":"      << doMove
+     << ",\"legal_moves\":" << legal
+     << ",\"evaluate\":"    << evaluate
+     << ",\"tt_probe\":"    << ttProbe
+     << ",\"see_ge\":"      << seeGe
+     << ",\"book_probe\":"  << book
+     << "}}";
+
+  sync_cout << ss.str() << sync_endl;
+}
+
 /// setup_bench() builds a list of UCI commands to be run by bench. There
 /// are five parameters: TT size in MiB, number of search threads that
 /// should be used, the limit value spent for each position, a file name
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <mutex>
 #include <numeric>
 #include <vector>
 
@@ -34,6 +35,11 @@ namespace {
   // Each uint32_t stores results of 32 positions, one per bit
   uint32_t KPKBitbase[MAX_INDEX / 32];
 
+  // The bitbase is generated on its first probe, so that processes that never
+  // reach a KPK endgame do not pay for it at startup.
+  std::once_flag generated;
+  void generate();
+
   // A KPK bitbase index is an integer in [0, IndexMax] range
   //
   // Information is mapped in a way that minimizes the number of iterations:
@@ -77,34 +83,35 @@ bool Bitbases::probe(Square wksq, Square wpsq, Square bksq, Color us) {
 
   assert(file_of(wpsq) <= FILE_D);
 
+  std::call_once(generated, generate);
+
   unsigned idx = index(us, bksq, wksq, wpsq);
   return KPKBitbase[idx / 32] & (1 << (idx & 0x1F));
 }
 
 
-void Bitbases::init() {
+namespace {
 
-  std::vector<KPKPosition> db(MAX_INDEX);
-  unsigned idx, repeat = 1;
+  void generate() {
 
-  // Initialize db with known win / draw positions
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      db[idx] = KPKPosition(idx);
+    std::vector<KPKPosition> db(MAX_INDEX);
+    unsigned idx, repeat = 1;
 
-  // Iterate through the positions until none of the unknown positions can be
-  // changed to either wins or draws (15 cycles needed).
-  while (repeat)
-      for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
-          repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+    // Initialize db with known win / draw positions
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        db[idx] = KPKPosition(idx);
 
-  // Map 32 results into one KPKBitbase[] entry
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      if (db[idx] == WIN)
-          KPKBitbase[idx / 32] |= 1 << (idx & 0x1F);
-}
+    // Iterate through the positions until none of the unknown positions can be
+    // changed to either wins or draws (15 cycles needed).
+    while (repeat)
+        for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
+            repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
 
-
-namespace {
+    // Map 32 results into one KPKBitbase[] entry
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        if (db[idx] == WIN)
+            KPKBitbase[idx / 32] |= 1 << (idx & 0x1F);
+  }
 
   KPKPosition::KPKPosition(unsigned idx) {
 
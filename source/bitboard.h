@@ -27,7 +27,6 @@
 
 namespace Bitbases {
 
-void init();
 bool probe(Square wksq, Square wpsq, Square bksq, Color us);
 
 }
@@ -279,7 +278,13 @@ inline Bitboard attacks_bb(PieceType pt, Square s, Bitboard occupied) {
 
 inline int popcount(Bitboard b) {
 
-#ifndef USE_POPCNT
+#if defined(USE_DISPATCH)
+
+  // A single popcnt in the code compiled for it, see Eval::set_terms(), and a
+  // library call elsewhere.
+  return __builtin_popcountll(b);
+
+#elif !defined(USE_POPCNT)
 
   extern uint8_t PopCnt16[1 << 16];
   union { Bitboard bb; uint16_t u[4]; } v = { b };
@@ -297,6 +302,63 @@ inline int popcount(Bitboard b) {
 }
 
 
+/// popcount_masked() stores in count[] the number of bits of b[i] & mask for
+/// the first n bitboards of b. Both arrays must have room, and b initialized
+/// data, up to a multiple of 8 entries. With AVX-512 or AVX2 the bitboards are
+/// counted 8 or 4 at a time, in parallel lanes. Other builds gain nothing from
+/// batching the counts, and SimdPopcount tells the callers so.
+
+#if defined(USE_AVX512) || defined(USE_AVX2)
+
+constexpr bool SimdPopcount = true;
+
+inline void popcount_masked(const Bitboard* b, Bitboard mask, int* count, int n) {
+
+#if defined(USE_AVX512)
+
+  const __m512i m = _mm512_set1_epi64(int64_t(mask));
+
+  for (int i = 0; i < n; i += 8)
+  {
+      __m512i c = _mm512_popcnt_epi64(_mm512_and_si512(_mm512_loadu_si512(b + i), m));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(count + i), _mm512_maskz_cvtepi64_epi32(0xFF, c));
+  }
+
+#else
+
+  // Count the bits of each nibble with a lookup table, then sum the bytes of
+  // each 64-bit lane and gather the four sums in the low half of the register.
+  const __m256i m = _mm256_set1_epi64x(int64_t(mask));
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i gather = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+
+  for (int i = 0; i < n; i += 4)
+  {
+      __m256i v = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)), m);
+      __m256i c = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(v, nibble)),
+                                  _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+      c = _mm256_permutevar8x32_epi32(_mm256_sad_epu8(c, _mm256_setzero_si256()), gather);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(count + i), _mm256_castsi256_si128(c));
+  }
+
+#endif
+}
+
+#else
+
+constexpr bool SimdPopcount = false;
+
+inline void popcount_masked(const Bitboard* b, Bitboard mask, int* count, int n) {
+
+  for (int i = 0; i < n; ++i)
+      count[i] = popcount(b[i] & mask);
+}
+
+#endif
+
+
 /// lsb() and msb() return the least/most significant bit in a non-zero bitboard
 
 #if defined(__GNUC__)  // GCC, Clang, ICC
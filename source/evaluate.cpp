@@ -32,15 +32,6 @@
 #include "thread.h"
 #include "uci.h"
 
-extern int Options_Junior_Depth;
-extern bool Options_Junior_Mobility;
-extern bool Options_Junior_King;
-extern bool Options_Junior_Threats;
-extern bool Options_Junior_Passed;
-extern bool Options_Junior_Space;
-extern bool Options_Junior_Initiative;
-extern bool Options_Shashin_Strategy;
-
 #define PAWN_SCORES
 
 namespace Trace {
@@ -231,6 +222,13 @@ namespace {
 
 #undef S
 
+  // Terms of the evaluation when not compiled for a fixed set, see Eval::set_terms()
+  constexpr int VARIABLE_TERMS = -1;
+  int activeTerms = Eval::ALL_TERMS;
+
+  template<int Terms>
+  inline bool has(int t) { return (Terms == VARIABLE_TERMS ? activeTerms : Terms) & t; }
+
   // Evaluation class computes and stores attacks tables and other working data
   template<Tracing T>
   class Evaluation {
@@ -239,7 +237,7 @@ namespace {
     Evaluation() = delete;
     explicit Evaluation(const Position& p) : pos(p) {}
     Evaluation& operator=(const Evaluation&) = delete;
-    Value value();
+    template<int Terms> Value value();
 
   private:
     template<Color Us> void initialize();
@@ -350,20 +348,39 @@ namespace {
     const Square* pl = pos.squares<Pt>(Us);
 
     Bitboard b, bb;
+    Bitboard attacks[16]; // Room for 10 pieces, rounded up to a multiple of the SIMD lanes
+    int mobs[16];
     Square s;
     Score score = SCORE_ZERO;
 
     attackedBy[Us][Pt] = 0;
 
-    while ((s = *pl++) != SQ_NONE)
+    // Find attacked squares, including x-ray attacks for bishops and rooks
+    auto attacks_of = [&](Square sq) {
+        Bitboard a = Pt == BISHOP ? attacks_bb<BISHOP>(sq, pos.pieces() ^ pos.pieces(QUEEN))
+                   : Pt ==   ROOK ? attacks_bb<  ROOK>(sq, pos.pieces() ^ pos.pieces(QUEEN) ^ pos.pieces(Us, ROOK))
+                                  : pos.attacks_from<Pt>(sq);
+
+        return pos.blockers_for_king(Us) & sq ? a & LineBB[pos.square<KING>(Us)][sq] : a;
+    };
+
+    // With SIMD, find the attacks of all the pieces first, so that their
+    // mobility is counted in one go.
+    if (SimdPopcount)
     {
-        // Find attacked squares, including x-ray attacks for bishops and rooks
-        b = Pt == BISHOP ? attacks_bb<BISHOP>(s, pos.pieces() ^ pos.pieces(QUEEN))
-          : Pt ==   ROOK ? attacks_bb<  ROOK>(s, pos.pieces() ^ pos.pieces(QUEEN) ^ pos.pieces(Us, ROOK))
-                         : pos.attacks_from<Pt>(s);
+        int n = 0;
+        for ( ; (s = pl[n]) != SQ_NONE; ++n)
+            attacks[n] = attacks_of(s);
 
-        if (pos.blockers_for_king(Us) & s)
-            b &= LineBB[pos.square<KING>(Us)][s];
+        for (int i = n; i & 7; ++i)
+            attacks[i] = 0;
+
+        popcount_masked(attacks, mobilityArea[Us], mobs, n);
+    }
+
+    for (int i = 0; (s = pl[i]) != SQ_NONE; ++i)
+    {
+        b = SimdPopcount ? attacks[i] : attacks_of(s);
 
         attackedBy2[Us] |= attackedBy[Us][ALL_PIECES] & b;
         attackedBy[Us][Pt] |= b;
@@ -376,7 +393,7 @@ namespace {
             kingAttacksCount[Us] += popcount(b & attackedBy[Them][KING]);
         }
 
-        int mob = popcount(b & mobilityArea[Us]);
+        int mob = SimdPopcount ? mobs[i] : popcount(b & mobilityArea[Us]);
 
         mobility[Us] += MobilityBonus[Pt - 2][mob];
 
@@ -958,7 +975,7 @@ namespace {
   // parts of the evaluation and returns the value of the position from the point
   // of view of the side to move.
 
-  template<Tracing T>
+  template<Tracing T> template<int Terms>
   Value Evaluation<T>::value() {
 
     assert(!pos.checkers());
@@ -985,7 +1002,10 @@ namespace {
     // Early exit if score is high
     Value v = (mg_value(score) + eg_value(score)) / 2;
     if (abs(v) > LazyThreshold)
+    {
+       STATS_COUNT(pos.this_thread(), STAT_LAZY_EVAL);
        return pos.side_to_move() == WHITE ? v : -v;
+    }
 
     // Main evaluation begins here
 
@@ -998,64 +1018,27 @@ namespace {
             + pieces<WHITE, ROOK  >() - pieces<BLACK, ROOK  >()
             + pieces<WHITE, QUEEN >() - pieces<BLACK, QUEEN >();
 
-	Value v_Shashin_test = v;
-	
-	constexpr double SHASHIN_ADVANTAGE_PAWNS_COUNT = 1.0;
-	constexpr Value SHASHIN_ADVANTAGE_VALUE = Value(int(SHASHIN_ADVANTAGE_PAWNS_COUNT * double(PawnValueMg + PawnValueEg) / 2.0));
-	constexpr double Shashin_Scale_Factor_Default = 1.0;
+    // There is no "Shashin Strategy" scaling of king safety and passed pawns,
+    // by factors 1 -/+ (1/2 - n) * Beta with n the advantage in pawns: it took
+    // Beta = abs(0.1 / (MidgameLimit + EndgameLimit)) through the integer abs(),
+    // that is zero, so both factors were always exactly one, and the option is gone.
+    if (has<Terms>(Eval::TERM_MOBILITY))
+        score += mobility[WHITE] - mobility[BLACK];
 
-	double king_Shashin_scale = Shashin_Scale_Factor_Default;
-	double passed_Shashin_scale = Shashin_Scale_Factor_Default;
+    if (has<Terms>(Eval::TERM_KING))
+        score += king<WHITE>() - king<BLACK>();
 
-	if (Options_Shashin_Strategy)
-	{
-		{
-			constexpr double Shashin_Winning_Scale_Factor_Default = 0.05;
+    if (has<Terms>(Eval::TERM_THREATS))
+        score += threats<WHITE>() - threats<BLACK>();
 
-			constexpr double Alpha = 0.5;
-			const double Beta = abs(Shashin_Winning_Scale_Factor_Default * 2 / (MidgameLimit + EndgameLimit));
+    if (has<Terms>(Eval::TERM_PASSED))
+        score += passed<WHITE>() - passed<BLACK>();
 
-			const double Shashin_Scale_Factor_Bonus = (-abs(v_Shashin_test / SHASHIN_ADVANTAGE_VALUE) + Alpha);
+    if (has<Terms>(Eval::TERM_SPACE))
+        score += space<WHITE>() - space<BLACK>();
 
-			if (abs(v_Shashin_test) >= double(PawnValueMg + PawnValueEg) / 2.0)
-			{
-				king_Shashin_scale = Shashin_Scale_Factor_Default - Shashin_Scale_Factor_Bonus * Beta;
-			}
-			else
-			{
-				passed_Shashin_scale = Shashin_Scale_Factor_Default + Shashin_Scale_Factor_Bonus * Beta;
-			}
-		}
-	}
-
-	if (Options_Junior_Mobility)
-	{
-		score += mobility[WHITE] - mobility[BLACK];
-	}
-	if (Options_Junior_King)
-	{
-		Score default_king = king<   WHITE>() - king<   BLACK>();
-		Score score_king = Score(int(double(default_king) * king_Shashin_scale));
-		score += score_king;
-	}
-	if (Options_Junior_Threats)
-	{
-		score += threats<WHITE>() - threats<BLACK>();
-	}
-	if (Options_Junior_Passed)
-	{
-		Score default_passed = passed< WHITE>() - passed< BLACK>();
-		Score score_passed = Score(int(double(default_passed) * passed_Shashin_scale));
-		score += score_passed;
-	}
-	if (Options_Junior_Space)
-	{
-		score += space<  WHITE>() - space<  BLACK>();
-	}
-	if (Options_Junior_Initiative)
-	{
-		score += initiative(eg_value(score));
-	}
+    if (has<Terms>(Eval::TERM_INITIATIVE))
+        score += initiative(eg_value(score));
 
 #ifdef PAWN_SCORES
 	score += pawn_center<WHITE>() - pawn_center<BLACK>();
@@ -1085,11 +1068,101 @@ namespace {
 } // namespace
 
 
+namespace {
+
+  typedef Value Evaluator(const Position&);
+
+  template<int Terms>
+  Value evaluate_terms(const Position& pos) {
+    return Evaluation<NO_TRACE>(pos).value<Terms>();
+  }
+
+#if defined(USE_DISPATCH)
+
+  // The x86-64-evaldispatch build also compiles the evaluation for the CPUs with
+  // popcnt, with everything it calls inlined, so that each popcount() there is
+  // a single instruction instead of a library call.
+  template<int Terms> __attribute__((flatten)) TARGET_POPCNT
+  Value evaluate_popcnt(const Position& pos) {
+    return evaluate_terms<Terms>(pos);
+  }
+
+#endif
+
+  // Returns the evaluation of the given terms compiled for this CPU
+  template<int Terms>
+  Evaluator* evaluator_for() {
+
+#if defined(USE_DISPATCH)
+    if (HasPopCnt)
+        return evaluate_popcnt<Terms>;
+#endif
+
+    return evaluate_terms<Terms>;
+  }
+
+  Evaluator* evaluator = evaluate_terms<Eval::ALL_TERMS>;
+
+} // namespace
+
+
+/// Cache::resize() sets the size of the cache in megabytes, rounded down to a
+/// power of two number of entries, and clears it. Zero disables the cache.
+
+void Eval::Cache::resize(size_t mbSize) {
+
+  size_t count = mbSize * 1024 * 1024 / sizeof(uint64_t);
+
+  while (count & (count - 1))
+      count &= count - 1;
+
+  if (count != table.size())
+      table.assign(count, 0);
+}
+
+
+/// set_terms() selects the evaluation terms in use, as a mask of Eval::Terms.
+/// Called at startup, once the CPU is known, and before each search, it picks
+/// the evaluation compiled for the default set when possible, so that the
+/// search pays nothing for the options, and for the instruction set found by
+/// Dispatch::init().
+
+void Eval::set_terms(int terms) {
+
+  activeTerms = terms;
+  evaluator = terms == ALL_TERMS ? evaluator_for<ALL_TERMS>()
+                                 : evaluator_for<VARIABLE_TERMS>();
+}
+
+
 /// evaluate() is the evaluator for the outer world. It returns a static
 /// evaluation of the position from the point of view of the side to move.
 
 Value Eval::evaluate(const Position& pos) {
-  return Evaluation<NO_TRACE>(pos).value();
+
+  Thread* th = pos.this_thread();
+  STATS_COUNT(th, STAT_EVAL_CALL);
+
+  if (!th->evalCache.enabled())
+      return evaluator(pos);
+
+  // Salt the key with the contempt and the terms in use, the other inputs of
+  // the evaluation that are not part of the position.
+  Key key =  pos.key()
+           ^ (uint64_t(uint32_t(th->contempt)) << 6 | uint64_t(activeTerms)) * 0x9E3779B97F4A7C15ULL;
+
+  uint64_t* e = th->evalCache.entry(key);
+  Thread::count(th->evalCacheProbes);
+
+  if (Cache::match(*e, key))
+  {
+      Thread::count(th->evalCacheHits);
+      return Cache::value(*e);
+  }
+
+  Value v = evaluator(pos);
+  *e = Cache::pack(key, v);
+  return v;
 }
 
 
@@ -1103,7 +1176,7 @@ std::string Eval::trace(const Position& pos) {
 
   pos.this_thread()->contempt = SCORE_ZERO; // Reset any dynamic contempt
 
-  Value v = Evaluation<TRACE>(pos).value();
+  Value v = Evaluation<TRACE>(pos).value<VARIABLE_TERMS>();
 
   v = pos.side_to_move() == WHITE ? v : -v; // Trace scores are from white's point of view
 
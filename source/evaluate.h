@@ -22,6 +22,7 @@
 #define EVALUATE_H_INCLUDED
 
 #include <string>
+#include <vector>
 
 #include "types.h"
 
@@ -31,8 +32,35 @@ namespace Eval {
 
 constexpr Value Tempo = Value(20); // Must be visible to search
 
+/// Evaluation terms that the "Junior ..." options can switch off. The evaluation
+/// is compiled for the default set, which has all of them, and for any other
+/// set, checked at run time.
+enum Terms {
+  TERM_MOBILITY = 1, TERM_KING = 2, TERM_THREATS = 4, TERM_PASSED = 8,
+  TERM_SPACE = 16, TERM_INITIATIVE = 32, ALL_TERMS = 63
+};
+
+/// Cache is a small per-thread table of full evaluations, in front of the
+/// evaluation itself. Each 64-bit entry keeps the upper 48 bits of the key and
+/// the 16-bit value. Keys are salted with anything else the value depends on,
+/// see Eval::evaluate(), so that a change of contempt never returns stale values.
+class Cache {
+
+  std::vector<uint64_t> table;
+
+public:
+  void resize(size_t mbSize);
+  bool enabled() const { return !table.empty(); }
+  uint64_t* entry(Key key) { return &table[size_t(key) & (table.size() - 1)]; }
+
+  static bool match(uint64_t e, Key key) { return (e ^ key) >> 16 == 0; }
+  static Value value(uint64_t e) { return Value(int16_t(uint16_t(e))); }
+  static uint64_t pack(Key key, Value v) { return (key & ~0xFFFFULL) | uint16_t(int16_t(v)); }
+};
+
 std::string trace(const Position& pos);
 
+void set_terms(int terms);
 Value evaluate(const Position& pos);
 }
 
@@ -0,0 +1,229 @@
+/*
+  SugaR, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  SugaR is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SugaR is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>   // For std::memcpy, std::memcmp
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "learn.h"
+#include "misc.h"
+#include "uci.h"
+
+LearningTable Learning; // Our global learning table
+
+namespace {
+
+  // The learning file is a header followed by one record per entry, in the
+  // same packed format as in memory, so a load is just a sequence of inserts.
+  struct LearnFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t count;
+  };
+
+  struct LearnRecord {
+    uint64_t key;
+    uint64_t data;
+  };
+
+  const char LearnFileMagic[8] = { 'S', 'u', 'g', 'a', 'R', 'L', 'R', 'N' };
+  constexpr uint32_t LearnFileVersion = 1;
+
+} // namespace
+
+
+/// LearningTable::pack() packs a result in 64 bits. The depth is never zero, so
+/// a zero data word marks an empty entry.
+
+uint64_t LearningTable::pack(Move m, Value v, Depth d) {
+
+  return  uint64_t(uint16_t(m))
+        | uint64_t(uint16_t(int16_t(v))) << 16
+        | uint64_t(uint8_t(d / ONE_PLY)) << 32;
+}
+
+
+/// LearningTable::init() allocates the table and loads the learning file when
+/// the "Learning" option is set, after saving any pending results. Otherwise
+/// it releases the table, so that probes and stores become no-ops.
+
+void LearningTable::init() {
+
+  save();
+  table.reset();
+
+  if (!Options["Learning"])
+      return;
+
+  std::string fname = Options["LearningFile"];
+  fileName = fname;
+  table.reset(new Entry[EntryCount]);
+
+  for (size_t i = 0; i < EntryCount; ++i)
+      table[i].keyXorData = table[i].data = 0;
+
+  dirty = false;
+
+  std::ifstream file(fileName, std::ios::in | std::ios::binary);
+  LearnFileHeader h;
+
+  if (!file)
+      return;
+
+  if (   !file.read(reinterpret_cast<char*>(&h), sizeof(h))
+      || std::memcmp(h.magic, LearnFileMagic, sizeof(h.magic))
+      || h.version != LearnFileVersion)
+  {
+      sync_cout << "info string " << fileName << " is not a learning file" << sync_endl;
+      return;
+  }
+
+  // Don't trust the count of a truncated or corrupted file for the allocation
+  file.seekg(0, std::ios::end);
+  size_t available = (size_t(file.tellg()) - sizeof(h)) / sizeof(LearnRecord);
+  file.seekg(sizeof(h));
+
+  std::vector<LearnRecord> records(std::min(size_t(h.count), available));
+  file.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(LearnRecord));
+  records.resize(size_t(file.gcount()) / sizeof(LearnRecord));
+
+  for (const LearnRecord& r : records)
+      if (depth_of(r.data) * ONE_PLY >= MinDepth)
+          insert(r.key, r.data);
+
+  dirty = false; // Nothing new to save yet
+
+  sync_cout << "info string Learning loaded: " << records.size()
+            << " entries from " << fileName << sync_endl;
+}
+
+
+/// LearningTable::save() writes all the entries to the learning file, if any
+/// was stored since the last load or save. Must not be called while searching.
+
+void LearningTable::save() {
+
+  if (!table || !dirty)
+      return;
+
+  std::vector<LearnRecord> records;
+
+  for (size_t i = 0; i < EntryCount; ++i)
+  {
+      uint64_t data = table[i].data.load(std::memory_order_relaxed);
+
+      if (data)
+          records.push_back({ table[i].keyXorData.load(std::memory_order_relaxed) ^ data, data });
+  }
+
+  LearnFileHeader h;
+  std::memcpy(h.magic, LearnFileMagic, sizeof(h.magic));
+  h.version = LearnFileVersion;
+  h.count   = uint32_t(records.size());
+
+  std::ofstream file(fileName, std::ios::out | std::ios::binary);
+  file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(LearnRecord));
+
+  if (!file)
+  {
+      sync_cout << "info string Could not write " << fileName << sync_endl;
+      return;
+  }
+
+  dirty = false;
+
+  sync_cout << "info string Learning saved: " << records.size()
+            << " entries to " << fileName << sync_endl;
+}
+
+
+/// LearningTable::probe() looks up the position in its bucket. An entry whose
+/// key and data do not match was torn by a concurrent store and is ignored.
+
+bool LearningTable::probe(Key key, Move& move, Value& value, Depth& depth) const {
+
+  if (!table)
+      return false;
+
+  const Entry* b = bucket(key);
+
+  for (size_t i = 0; i < BucketSize; ++i)
+  {
+      uint64_t data = b[i].data.load(std::memory_order_relaxed);
+
+      if (data && (b[i].keyXorData.load(std::memory_order_relaxed) ^ data) == key)
+      {
+          move  = Move(uint16_t(data));
+          value = Value(int16_t(uint16_t(data >> 16)));
+          depth = depth_of(data) * ONE_PLY;
+          return true;
+      }
+  }
+
+  return false;
+}
+
+
+/// LearningTable::store() records the result of a completed root iteration.
+/// Results below MinDepth are ignored.
+
+void LearningTable::store(Key key, Move move, Value value, Depth depth) {
+
+  if (table && depth >= MinDepth && move != MOVE_NONE)
+      insert(key, pack(move, value, std::min(depth, Depth(255 * ONE_PLY))));
+}
+
+
+/// LearningTable::insert() keeps the deepest result for a position. When the
+/// position is new to the bucket, it takes an empty entry or replaces the
+/// shallowest one, unless that one is deeper than the new result.
+
+void LearningTable::insert(Key key, uint64_t data) {
+
+  Entry* b = bucket(key);
+  Entry* replace = nullptr;
+
+  for (size_t i = 0; i < BucketSize; ++i)
+  {
+      uint64_t d = b[i].data.load(std::memory_order_relaxed);
+
+      if (!d || (b[i].keyXorData.load(std::memory_order_relaxed) ^ d) == key)
+      {
+          if (d && depth_of(d) > depth_of(data))
+              return;
+
+          replace = &b[i];
+          break;
+      }
+
+      if (!replace || depth_of(d) < depth_of(replace->data.load(std::memory_order_relaxed)))
+          replace = &b[i];
+  }
+
+  if (depth_of(replace->data.load(std::memory_order_relaxed)) > depth_of(data))
+      return;
+
+  replace->keyXorData.store(key ^ data, std::memory_order_relaxed);
+  replace->data.store(data, std::memory_order_relaxed);
+  dirty = true;
+}
@@ -0,0 +1,68 @@
+/*
+  SugaR, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  SugaR is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SugaR is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LEARN_H_INCLUDED
+#define LEARN_H_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "types.h"
+
+/// LearningTable keeps the results of completed root iterations (best move,
+/// score and depth) keyed by position, and persists them in a small file of
+/// its own so that they survive restarts. Entries use the lockless hashing
+/// scheme: the key is stored xor'ed with the data, so probes detect torn
+/// writes and the search threads update the table without any lock.
+
+class LearningTable {
+
+  static constexpr size_t BucketSize = 4;
+  static constexpr size_t EntryCount = 1 << 18; // 4 MiB
+
+  struct Entry {
+    std::atomic<uint64_t> keyXorData, data;
+  };
+
+public:
+  static constexpr Depth MinDepth = 12 * ONE_PLY; // Shallower results are not worth keeping
+
+  void init();
+  void save();
+  bool enabled() const { return bool(table); }
+  bool probe(Key key, Move& move, Value& value, Depth& depth) const;
+  void store(Key key, Move move, Value value, Depth depth);
+
+private:
+  static uint64_t pack(Move m, Value v, Depth d);
+  static int depth_of(uint64_t data) { return int(data >> 32) & 0xFF; }
+  void insert(Key key, uint64_t data);
+
+  Entry* bucket(Key key) const { return &table[(size_t(key) & (EntryCount - 1)) & ~(BucketSize - 1)]; }
+
+  std::unique_ptr<Entry[]> table;
+  std::string fileName;
+  std::atomic<bool> dirty;
+};
+
+extern LearningTable Learning;
+
+#endif // #ifndef LEARN_H_INCLUDED
@@ -27,6 +27,7 @@
 #include <time.h>
 
 #include "bitboard.h"
+#include "endgame.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -34,6 +35,7 @@
 #include "uci.h"
 #include "syzygy/tbprobe.h"
 #include "polybook.h"
+#include "learn.h"
 
 namespace PSQT {
   void init();
@@ -41,6 +43,10 @@ namespace PSQT {
 
 int main(int argc, char* argv[]) {
 
+  TimePoint startTime = now();
+  Dispatch::init(); // Before anything depends on the instruction set
+  Eval::set_terms(Eval::ALL_TERMS);
+
 	{
 #ifdef _WIN32
 		const size_t time_length_const = 100;
@@ -80,17 +86,24 @@ int main(int argc, char* argv[]) {
   PSQT::init();
   Bitboards::init();
   Position::init();
-  Bitbases::init();
+  Endgames::init();
 
   Search::init(Options["Clear Search"]);
   Pawns::init();
-  polybook.init(Options["BookFile"]);
+  polybook.init();
+  Learning.init();
   Tablebases::init(Options["SyzygyPath"]); // After Bitboards are set
+  Numa::init(Options["Thread Binding"]);
+  TT.defer(); // Allocated on first "isready" or "go", after "uciok"
   Threads.set(Options["Threads"]);
   Search::clear(); // After threads are up
 
+  Output::start();
+  UCI::StartupTime = now() - startTime;
   UCI::loop(argc, argv);
 
   Threads.set(0);
+  Output::stop();
+  Learning.save();
   return 0;
 }
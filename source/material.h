@@ -37,7 +37,7 @@ namespace Material {
 /// instance, in KRB vs KR endgames, the score is scaled down by a factor of 4,
 /// which will result in scores of absolute value less than one pawn.
 
-struct Entry {
+struct alignas(64) Entry {
 
   Score imbalance() const { return make_score(value, value); }
   Phase game_phase() const { return gamePhase; }
@@ -64,6 +64,9 @@ struct Entry {
   Phase gamePhase;
 };
 
+// One cache line each, so that a probe never touches two lines
+static_assert(sizeof(Entry) == 64, "Material::Entry size incorrect");
+
 typedef HashTable<Entry, 8192> Table;
 
 Entry* probe(const Position& pos);
@@ -41,8 +41,16 @@ typedef bool(WINAPI *fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 
 #include "VersionHelpers.h"
 }
+#elif defined(__linux__)
+#include <sched.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -139,12 +147,45 @@ const string engine_info(bool to_uci) {
 
   ss << (Is64Bit ? " 64" : " 32")
      << (HasPext ? " BMI2" : (HasPopCnt ? " POPCNT" : ""))
+     << (HasAvx512 ? " AVX512" : (HasAvx2 ? " AVX2" : ""))
      << (to_uci  ? "\nid author ": " by ")
      << "Marco Zerbinati, Sergey Aleksandrovitch Kozlov";
 
 	 return ss.str();
 }
 
+#if defined(USE_DISPATCH)
+bool HasPopCnt, HasAvx2;
+#endif
+
+void Dispatch::init() {
+
+#if defined(USE_DISPATCH)
+  __builtin_cpu_init();
+
+  HasPopCnt = __builtin_cpu_supports("popcnt");
+  HasAvx2   = __builtin_cpu_supports("avx2");
+#endif
+}
+
+/// Dispatch::code_path() describes the code used for the slider attacks, the
+/// popcounts and the SIMD kernels, and whether it was chosen at run time.
+
+std::string Dispatch::code_path() {
+
+  std::stringstream ss;
+
+  ss << (HasPext ? "pext" : "magics")
+     << (HasPopCnt ? ", popcnt" : ", table popcount")
+     << (HasAvx512 ? ", AVX-512" : (HasAvx2 ? ", AVX2" : ""));
+
+#if defined(USE_DISPATCH)
+  ss << " (popcnt and AVX2 selected at run time)";
+#endif
+
+  return ss.str();
+}
+
 const std::string system_info()
 {
 	std::stringstream result;
@@ -326,6 +367,8 @@ const std::string hardware_info()
 	}
 #endif 
 
+	result << "  Code path          : " << Dispatch::code_path() << std::endl;
+
 	return result.str();
 }
 
@@ -362,7 +405,8 @@ const std::string cores_info()
 
 
 /// Debug functions used mainly to collect run-time statistics
-static int64_t hits[2], means[2];
+/// They are safe to call from any thread, at the cost of atomic increments.
+static std::atomic<int64_t> hits[2], means[2];
 
 void dbg_hit_on(bool b) { ++hits[0]; if (b) ++hits[1]; }
 void dbg_hit_on(bool c, bool b) { if (c) dbg_hit_on(b); }
@@ -383,20 +427,163 @@ void dbg_print() {
 /// Used to serialize access to std::cout to avoid multiple threads writing at
 /// the same time.
 
-std::ostream& operator<<(std::ostream& os, SyncCout sc) {
+namespace {
+
+  Mutex ioMutex;
 
-  static Mutex m;
+  // Single-producer single-consumer ring of output lines. The producer owns
+  // 'tail' and the writer thread owns 'head', each slot belongs to exactly one
+  // of them at a time, so no lock is needed to move lines through the queue.
+  // The writer sleeps on a condition variable when the queue is empty, and the
+  // producer only takes the mutex when it sees the writer asleep. Likewise,
+  // threads waiting in sync_cout for the queue to drain sleep on 'drained',
+  // and the writer signals it only when it empties the queue while they wait.
+  namespace Channel {
+
+    constexpr size_t Size = 4096;
+
+    std::string ring[Size];
+    std::atomic<size_t> head, tail;
+    std::atomic<bool> running, sleeping;
+    std::atomic<int> draining;
+    Mutex mutex;
+    ConditionVariable cv, drained;
+    std::thread writer;
+
+    bool empty() { return head == tail; }
+
+    void write_loop() {
+
+      while (true)
+      {
+          if (empty())
+          {
+              std::unique_lock<Mutex> lk(mutex);
+              sleeping = true;
+
+              // Check again after announcing that we sleep, the producer may
+              // have pushed in the meantime without seeing the flag.
+              if (empty() && running)
+                  cv.wait(lk, []{ return !empty() || !running; });
+
+              sleeping = false;
+
+              if (empty()) // Stopped and fully drained
+                  return;
+          }
+
+          size_t h = head.load(std::memory_order_relaxed);
+
+          {
+              std::unique_lock<Mutex> lk(ioMutex);
+              std::cout << ring[h % Size] << std::endl;
+          }
+
+          ring[h % Size].clear();
+          head.store(h + 1); // Sequentially consistent, pairs with 'draining'
+
+          if (draining && empty())
+          {
+              std::unique_lock<Mutex> lk(mutex);
+              drained.notify_all();
+          }
+      }
+    }
+
+    // Waits until the writer thread has written all the queued lines
+    void wait_drained() {
+
+      std::unique_lock<Mutex> lk(mutex);
+      ++draining;
+      drained.wait(lk, []{ return empty() || !running; });
+      --draining;
+    }
+
+  } // namespace Channel
+
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, SyncCout sc) {
 
   if (sc == IO_LOCK)
-      m.lock();
+  {
+      // Let the writer thread flush what is queued before any direct output,
+      // so that for instance "readyok" never overtakes a pending "bestmove".
+      if (Channel::running && !Channel::empty())
+          Channel::wait_drained();
+
+      ioMutex.lock();
+  }
 
   if (sc == IO_UNLOCK)
-      m.unlock();
+      ioMutex.unlock();
 
   return os;
 }
 
 
+/// Output::start() launches the writer thread, Output::stop() waits until the
+/// queue has been drained and joins it. Output::push() hands a line over to the
+/// writer thread, and must be called only from one thread at a time.
+
+namespace Output {
+
+  bool Muted = false;
+
+  void start() {
+
+    if (Channel::running)
+        return;
+
+    Channel::head = Channel::tail = 0;
+    Channel::running = true;
+    Channel::writer = std::thread(Channel::write_loop);
+  }
+
+  void stop() {
+
+    if (!Channel::running)
+        return;
+
+    {
+        std::unique_lock<Mutex> lk(Channel::mutex);
+        Channel::running = false;
+    }
+
+    Channel::cv.notify_one();
+    Channel::writer.join();
+  }
+
+  void push(std::string&& line) {
+
+    if (Muted)
+        return;
+
+    if (!Channel::running)
+    {
+        sync_cout << line << sync_endl;
+        return;
+    }
+
+    size_t t = Channel::tail.load(std::memory_order_relaxed);
+
+    // The queue is full only when the GUI does not read, wait for some room
+    while (t - Channel::head.load(std::memory_order_acquire) >= Channel::Size)
+        std::this_thread::yield();
+
+    Channel::ring[t % Channel::Size] = std::move(line);
+    Channel::tail.store(t + 1); // Sequentially consistent, pairs with 'sleeping'
+
+    if (Channel::sleeping)
+    {
+        std::unique_lock<Mutex> lk(Channel::mutex);
+        Channel::cv.notify_one();
+    }
+  }
+
+} // namespace Output
+
+
 /// Trampoline helper to avoid moving Logger to misc.h
 void start_logger(const std::string& fname) { Logger::start(fname); }
 
@@ -433,13 +620,16 @@ void prefetch2(void* addr) {
   prefetch((uint8_t*)addr + 64);
 }
 
-namespace WinProcGroup {
+namespace Numa {
 
-#ifndef _WIN32
+namespace {
 
-void bindThisThread(size_t) {}
+  enum BindMode { OFF, AUTO, MAP };
 
-#else
+  BindMode bindMode = AUTO;
+  std::vector<int> nodeMap; // Node of each thread with the explicit map, cycled
+
+#if defined(_WIN32)
 
 /// best_group() retrieves logical processor information using Windows specific
 /// API and returns the best group id for the thread with index idx. Original
@@ -511,15 +701,15 @@ int best_group(size_t idx) {
 }
 
 
-/// bindThisThread() set the group affinity of the current thread
 
-void bindThisThread(size_t idx) {
+/// auto_node() returns the node for thread idx in auto mode, or -1
 
-  // Use only local variables to be thread-safe
-  int group = best_group(idx);
+int auto_node(size_t idx) { return best_group(idx); }
 
-  if (group == -1)
-      return;
+
+/// bind_to_node() sets the group affinity of the current thread to the node
+
+void bind_to_node(int node) {
 
   // Early exit if the needed API are not available at runtime
   HMODULE k32 = GetModuleHandle("Kernel32.dll");
@@ -530,10 +720,184 @@ void bindThisThread(size_t idx) {
       return;
 
   GROUP_AFFINITY affinity;
-  if (fun2(group, &affinity))
+  if (fun2(USHORT(node), &affinity))
       fun3(GetCurrentThread(), &affinity, nullptr);
 }
 
+#elif defined(__linux__)
+
+/// node_cpus() returns the logical processors of each online NUMA node, read
+/// once from sysfs. Nodes are indexed by their id, which may leave holes.
+
+const std::vector<std::vector<int>>& node_cpus() {
+
+  static const std::vector<std::vector<int>> nodes = [] {
+
+    std::vector<std::vector<int>> v;
+
+    for (int n = 0; n < 1024; ++n)
+    {
+        std::ifstream f("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+        std::string list;
+
+        if (!f)
+        {
+            if (n >= 64) // Node ids are dense in practice, give up after a gap
+                break;
+            continue;
+        }
+
+        v.resize(n + 1);
+        std::getline(f, list);
+        std::stringstream ss(list);
+
+        // The format is a comma separated list of ranges, as in "0-7,16-23"
+        for (std::string range; std::getline(ss, range, ',');)
+        {
+            int first, last;
+            char dash;
+            std::stringstream rs(range);
+
+            if (!(rs >> first))
+                continue;
+
+            if (!(rs >> dash >> last))
+                last = first;
+
+            for (int cpu = first; cpu <= last; ++cpu)
+                v[n].push_back(cpu);
+        }
+    }
+    return v;
+  }();
+
+  return nodes;
+}
+
+
+/// auto_node() spreads the threads round-robin over the nodes that have
+/// processors. On a single node machine there is nothing to do.
+
+int auto_node(size_t idx) {
+
+  std::vector<int> ids;
+
+  for (size_t n = 0; n < node_cpus().size(); ++n)
+      if (!node_cpus()[n].empty())
+          ids.push_back(int(n));
+
+  return ids.size() > 1 ? ids[idx % ids.size()] : -1;
+}
+
+
+/// bind_to_node() sets the affinity of the current thread to the processors
+/// of the node. Memory is then allocated on that node by the default first
+/// touch policy of the kernel, as long as the thread is the first to write it.
+
+void bind_to_node(int node) {
+
+  if (node >= int(node_cpus().size()) || node_cpus()[node].empty())
+      return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  for (int cpu : node_cpus()[node])
+      if (cpu < CPU_SETSIZE)
+          CPU_SET(cpu, &set);
+
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+#elif defined(__APPLE__)
+
+/// macOS has no NUMA nodes and does not let a thread be pinned. Threads with
+/// the same affinity tag are only scheduled to share caches when possible,
+/// so an explicit map is passed as a hint and auto mode does nothing.
+
+int auto_node(size_t) { return -1; }
+
+void bind_to_node(int node) {
+
+  thread_affinity_policy_data_t policy = { node + 1 }; // Tag 0 means no affinity
+  thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY,
+                    (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
+}
+
+#else
+
+int auto_node(size_t) { return -1; }
+
+void bind_to_node(int) {}
+
 #endif
 
-} // namespace WinProcGroup
+} // namespace
+
+
+/// init() sets the binding mode from the "Thread Binding" UCI option: "off",
+/// "auto", or a comma separated list of NUMA nodes, as in "0,1", giving the
+/// node of each thread in turn. Must be called before the threads are created.
+
+void init(const std::string& setting) {
+
+  std::string s = setting;
+  std::transform(s.begin(), s.end(), s.begin(), [](char c) { return char(tolower(c)); });
+
+  nodeMap.clear();
+  bindMode = s == "off" ? OFF : s == "auto" ? AUTO : MAP;
+
+  if (bindMode != MAP)
+      return;
+
+  std::stringstream ss(s);
+
+  for (std::string token; std::getline(ss, token, ',');)
+  {
+      std::stringstream ts(token);
+      int node;
+
+      if (!(ts >> node) || node < 0)
+      {
+          sync_cout << "info string Invalid Thread Binding " << setting << ", using auto" << sync_endl;
+          nodeMap.clear();
+          bindMode = AUTO;
+          return;
+      }
+
+      nodeMap.push_back(node);
+  }
+
+  if (nodeMap.empty())
+      bindMode = AUTO;
+}
+
+
+/// node_for() returns the node of the idx-th of threadCount threads, or -1 if
+/// it is not to be bound. In auto mode nothing is bound below 8 threads: if
+/// the OS already scheduled us on some node then don't overwrite the choice,
+/// eventually we are one of many one-threaded processes running on the same
+/// machine.
+
+int node_for(size_t idx, size_t threadCount) {
+
+  return  bindMode == MAP                      ? nodeMap[idx % nodeMap.size()]
+        : bindMode == AUTO && threadCount >= 8 ? auto_node(idx)
+                                               : -1;
+}
+
+
+/// bindThisThread() binds the current thread to its node and returns the node,
+/// or -1 if the thread is left to the OS.
+
+int bindThisThread(size_t idx, size_t threadCount) {
+
+  int node = node_for(idx, threadCount);
+
+  if (node >= 0)
+      bind_to_node(node);
+
+  return node;
+}
+
+} // namespace Numa
@@ -21,8 +21,11 @@
 #ifndef MISC_H_INCLUDED
 #define MISC_H_INCLUDED
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstring>
+#include <memory>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -52,12 +55,47 @@ inline TimePoint now() {
         (std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-template<class Entry, int Size>
+/// HashTable is a per-thread cache of Entry, such as the pawn and material
+/// tables. It has a power of two number of entries, DefaultSize until resized,
+/// and starts on a cache line boundary.
+
+template<class Entry, int DefaultSize>
 struct HashTable {
-  Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
+
+  HashTable() { allocate(DefaultSize); }
+
+  Entry* operator[](Key key) { return &table[(uint32_t)key & mask]; }
+
+  // Resize to the power of two number of entries nearest to kbSize kilobytes.
+  // Entries are plain data, so a new table is just zeroed memory.
+  void resize(size_t kbSize) {
+
+    size_t count = std::max(kbSize * 1024 / sizeof(Entry), size_t(1)), p = 1;
+
+    while (p * 2 <= count)
+        p *= 2;
+
+    if (count - p > 2 * p - count)
+        p *= 2;
+
+    if (p != mask + 1)
+        allocate(p);
+  }
 
 private:
-  std::vector<Entry> table = std::vector<Entry>(Size);
+  static constexpr uintptr_t CacheLineSize = 64;
+
+  void allocate(size_t count) {
+
+    mem.reset(new char[count * sizeof(Entry) + CacheLineSize - 1]);
+    table = reinterpret_cast<Entry*>((uintptr_t(mem.get()) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+    std::memset(static_cast<void*>(table), 0, count * sizeof(Entry));
+    mask = count - 1;
+  }
+
+  std::unique_ptr<char[]> mem;
+  Entry* table;
+  size_t mask;
 };
 
 
@@ -67,6 +105,17 @@ std::ostream& operator<<(std::ostream&, SyncCout);
 #define sync_cout std::cout << IO_LOCK
 #define sync_endl std::endl << IO_UNLOCK
 
+/// Output is a dedicated writer thread for the search output. The main search
+/// thread pushes preformatted lines into a lock-free single-producer queue and
+/// goes on searching, while the writer thread takes care of the (possibly slow)
+/// GUI pipe. Until start() is called, push() writes directly to std::cout.
+namespace Output {
+  extern bool Muted; // Lines are dropped, set only between searches
+  void start();
+  void stop();
+  void push(std::string&& line);
+}
+
 
 /// xorshift64star Pseudo-Random Number Generator
 /// This class is based on original code written and dedicated
@@ -105,14 +154,27 @@ public:
 };
 
 
-/// Under Windows it is not possible for a process to run on more than one
-/// logical processor group. This usually means to be limited to use max 64
-/// cores. To overcome this, some special platform specific API should be
-/// called to set group affinity for each thread. Original code from Texel by
-/// Peter Österlund.
+/// Dispatch detects at startup, with cpuid, the instruction set extensions that
+/// a USE_DISPATCH build may use: popcnt, for which Eval::set_terms() then picks
+/// the evaluation compiled with it, and AVX2 for the move scoring. In other
+/// builds the extensions are fixed at compile time, and init() does nothing.
+
+namespace Dispatch {
+  void init();
+  std::string code_path();
+}
+
+
+/// Numa binds search threads to NUMA nodes, following the "Thread Binding"
+/// UCI option. Under Windows it is also needed to use more than one logical
+/// processor group, which usually means more than 64 cores; this part's
+/// original code is from Texel by Peter Österlund. Under Linux threads are
+/// pinned to the processors of their node with sched_setaffinity().
 
-namespace WinProcGroup {
-  void bindThisThread(size_t idx);
+namespace Numa {
+  void init(const std::string& setting);
+  int node_for(size_t idx, size_t threadCount);
+  int bindThisThread(size_t idx, size_t threadCount);
 }
 
 #endif // #ifndef MISC_H_INCLUDED
@@ -49,8 +49,113 @@ namespace {
         }
   }
 
+#if defined(USE_AVX2) || defined(USE_DISPATCH)
+
+  static_assert(sizeof(ExtMove) == 8, "ExtMove must pack a move and its value");
+
+  // load_moves() loads 8 moves, one per 32-bit lane in the order 0 4 1 5 2 6 3 7,
+  // and keeps the two halves of the list for store_values().
+  TARGET_AVX2 inline __m256i load_moves(const ExtMove* m, __m256i& lo, __m256i& hi) {
+
+    lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m));
+    hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m + 4));
+    return _mm256_blend_epi32(lo, _mm256_slli_epi64(hi, 32), 0xAA);
+  }
+
+  // store_values() writes back 8 values, in the lane order of load_moves()
+  TARGET_AVX2 inline void store_values(ExtMove* m, __m256i lo, __m256i hi, __m256i v) {
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(m), _mm256_blend_epi32(lo, _mm256_slli_epi64(v, 32), 0xAA));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(m + 4), _mm256_blend_epi32(hi, v, 0xAA));
+  }
+
+  // gather16() gathers 8 history entries. The 32-bit loads read the following
+  // entry too, whose bits are shifted out.
+  template<typename T>
+  TARGET_AVX2 inline __m256i gather16(const T* table, __m256i idx) {
+
+    __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), idx, 2);
+    return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+  }
+
+  // load_pieces() reads the piece on the from (moved piece) or to (captured
+  // piece) square of 8 moves, in the lane order of load_moves().
+  template<bool From>
+  TARGET_AVX2 inline __m256i load_pieces(const Position& pos, const ExtMove* m) {
+
+    alignas(32) int pc[8];
+    const int order[] = { 0, 4, 1, 5, 2, 6, 3, 7 };
+
+    for (int i = 0; i < 8; ++i)
+        pc[i] = pos.piece_on(From ? from_sq(m[order[i]]) : to_sq(m[order[i]]));
+
+    return _mm256_load_si256(reinterpret_cast<const __m256i*>(pc));
+  }
+
+  // score_quiets() and score_captures() compute the same values as the scalar
+  // code in MovePicker::score(), 8 moves at a time. They return the first move
+  // left to be scored.
+  TARGET_AVX2 ExtMove* score_quiets(const Position& pos, ExtMove* begin, ExtMove* end,
+                        const ButterflyHistory* mh, const PieceToHistory** ch) {
+
+    const auto* butterfly = (*mh)[pos.side_to_move()].data();
+    const auto* ch0 = ch[0]->data();
+    const auto* ch1 = ch[1]->data();
+    const auto* ch3 = ch[3]->data();
+
+    for ( ; end - begin >= 8; begin += 8)
+    {
+        __m256i lo, hi;
+        __m256i m  = load_moves(begin, lo, hi);
+        __m256i ft = _mm256_and_si256(m, _mm256_set1_epi32(0xFFF));
+        __m256i pc = load_pieces<true>(pos, begin);
+
+        // Slot of the piece in the continuation histories, see PieceStats::slot()
+        pc = _mm256_sub_epi32(pc, _mm256_slli_epi32(_mm256_srli_epi32(pc, 3), 1));
+
+        __m256i pt = _mm256_add_epi32(_mm256_slli_epi32(pc, 6),
+                                      _mm256_and_si256(m, _mm256_set1_epi32(0x3F)));
+
+        __m256i v = _mm256_add_epi32(_mm256_add_epi32(gather16(butterfly, ft), gather16(ch0, pt)),
+                                     _mm256_add_epi32(gather16(ch1, pt), gather16(ch3, pt)));
+        store_values(begin, lo, hi, v);
+    }
+    return begin;
+  }
+
+  TARGET_AVX2 ExtMove* score_captures(const Position& pos, ExtMove* begin, ExtMove* end,
+                          const CapturePieceToHistory* cph) {
+
+    const auto* capture = cph->data();
+    const int* pieceValue = reinterpret_cast<const int*>(PieceValue[MG]);
+
+    for ( ; end - begin >= 8; begin += 8)
+    {
+        __m256i lo, hi;
+        __m256i m  = load_moves(begin, lo, hi);
+        __m256i captured = load_pieces<false>(pos, begin);
+        __m256i pt = _mm256_add_epi32(_mm256_slli_epi32(load_pieces<true>(pos, begin), 6),
+                                      _mm256_and_si256(m, _mm256_set1_epi32(0x3F)));
+        __m256i idx = _mm256_add_epi32(_mm256_slli_epi32(pt, 3),
+                                       _mm256_and_si256(captured, _mm256_set1_epi32(7)));
+
+        // Divide by 16 rounding towards zero, as the scalar division does
+        __m256i h = gather16(capture, idx);
+        h = _mm256_add_epi32(h, _mm256_and_si256(_mm256_srai_epi32(h, 31), _mm256_set1_epi32(15)));
+
+        __m256i v = _mm256_add_epi32(_mm256_i32gather_epi32(pieceValue, captured, 4),
+                                     _mm256_srai_epi32(h, 4));
+        store_values(begin, lo, hi, v);
+    }
+    return begin;
+  }
+
+#endif
+
 } // namespace
 
+Depth MovePicker::LazyDepth = DEPTH_ZERO;
+
 
 /// Constructors of the MovePicker class. As arguments we pass information
 /// to help it to return the (presumably) good moves first, to decide which
@@ -96,10 +201,39 @@ MovePicker::MovePicker(const Position& p, Move ttm, Value th, const CapturePiece
   ttMove =   ttm
           && pos.pseudo_legal(ttm)
           && pos.capture(ttm)
-          && pos.see_ge(ttm, threshold) ? ttm : MOVE_NONE;
+          && see_ge(ttm, threshold) ? ttm : MOVE_NONE;
   stage += (ttMove == MOVE_NONE);
 }
 
+/// MovePicker::see_ge() is Position::see_ge() with a cache of what is known on
+/// the SEE value of the last move tested. The search tests the move that we
+/// have just returned again, with its own thresholds, and a good capture that
+/// passed our threshold usually passes the pruning one too.
+bool MovePicker::see_ge(Move m, Value th) {
+
+  if (m != seeMove)
+  {
+      seeMove = m;
+      seeLo = -VALUE_INFINITE;
+      seeHi =  VALUE_INFINITE;
+  }
+
+  if (th <= seeLo)
+      return true;
+
+  if (th >= seeHi)
+      return false;
+
+  if (pos.see_ge(m, th))
+  {
+      seeLo = th;
+      return true;
+  }
+
+  seeHi = th;
+  return false;
+}
+
 /// MovePicker::score() assigns a numerical value to each move in a list, used
 /// for sorting. Captures are ordered by Most Valuable Victim (MVV), preferring
 /// captures with a good history. Quiets moves are ordered using the histories.
@@ -108,7 +242,20 @@ void MovePicker::score() {
 
   static_assert(Type == CAPTURES || Type == QUIETS || Type == EVASIONS, "Wrong type");
 
-  for (auto& m : *this)
+  ExtMove* it = cur;
+
+#if defined(USE_AVX2) || defined(USE_DISPATCH)
+  if (Type == CAPTURES && HasAvx2)
+      it = score_captures(pos, cur, endMoves, captureHistory);
+
+  else if (Type == QUIETS && HasAvx2)
+      it = score_quiets(pos, cur, endMoves, mainHistory, continuationHistory);
+#endif
+
+  for ( ; it < endMoves; ++it)
+  {
+      ExtMove& m = *it;
+
       if (Type == CAPTURES)
           m.value =  PieceValue[MG][pos.piece_on(to_sq(m))]
                    + (*captureHistory)[pos.moved_piece(m)][to_sq(m)][type_of(pos.piece_on(to_sq(m)))] / 16;
@@ -129,6 +276,7 @@ void MovePicker::score() {
                        + (*continuationHistory[0])[pos.moved_piece(m)][to_sq(m)]
                        - (1 << 28);
       }
+  }
 }
 
 /// MovePicker::select() returns the next move satisfying a predicate function.
@@ -176,7 +324,7 @@ top:
 
   case GOOD_CAPTURE:
       if (select<Best>([&](){
-                       return pos.see_ge(move, Value(-55 * (cur-1)->value / 1024)) ?
+                       return see_ge(move, Value(-55 * (cur-1)->value / 1024)) ?
                               // Move losing capture to endBadCaptures to be tried later
                               true : (*endBadCaptures++ = move, false); }))
           return move;
@@ -206,16 +354,25 @@ top:
       endMoves = generate<QUIETS>(pos, cur);
 
       score<QUIETS>();
-      partial_insertion_sort(cur, endMoves, -4000 * depth / ONE_PLY);
+
+      // At low depths only a few quiets are tried, so they are picked one by
+      // one when needed instead of being sorted up front.
+      if (depth > LazyDepth)
+          partial_insertion_sort(cur, endMoves, -4000 * depth / ONE_PLY);
+
       ++stage;
       /* fallthrough */
 
   case QUIET:
-      if (   !skipQuiets
-          && select<Next>([&](){return   move != refutations[0]
-                                      && move != refutations[1]
-                                      && move != refutations[2];}))
-          return move;
+      if (!skipQuiets)
+      {
+          auto notRefutation = [&](){ return   move != refutations[0]
+                                            && move != refutations[1]
+                                            && move != refutations[2]; };
+
+          if (depth > LazyDepth ? select<Next>(notRefutation) : select<Best>(notRefutation))
+              return move;
+      }
 
       // Prepare the pointers to loop over the bad captures
       cur = moves;
@@ -239,7 +396,7 @@ top:
       return select<Best>(Any);
 
   case PROBCUT:
-      return select<Best>([&](){ return pos.see_ge(move, threshold); });
+      return select<Best>([&](){ return see_ge(move, threshold); });
 
   case QCAPTURE:
       if (select<Best>([&](){ return   depth > DEPTH_QS_RECAPTURES
@@ -80,6 +80,29 @@ struct Stats<T, D, Size> : public std::array<StatsEntry<T, D>, Size> {
 /// In stats table, D=0 means that the template parameter is not used
 enum StatsParams { NOT_USED = 0 };
 
+/// PieceStats is a table of stats indexed first by piece. The piece codes 7, 8
+/// and 15 are never used, so only NO_PIECE and the 12 pieces get a slot: this
+/// cuts the continuation history, by far the largest table of a thread, by a
+/// third. Only Piece is accepted as index, so that no caller skips slot().
+template<typename T>
+struct PieceStats : public std::array<T, PIECE_NB - 3> {
+
+  typedef std::array<T, PIECE_NB - 3> Base;
+
+  static int slot(Piece pc) { return pc - 2 * (pc >> 3); }
+
+  T& operator[](Piece pc) { return Base::operator[](slot(pc)); }
+  const T& operator[](Piece pc) const { return Base::operator[](slot(pc)); }
+
+  auto get() -> decltype(this->at(0).get()) { return this->at(0).get(); }
+
+  template<typename V>
+  void fill(const V& v) {
+    auto* p = get();
+    std::fill(p, p + sizeof(*this) / sizeof(*p), v);
+  }
+};
+
 
 /// ButterflyHistory records how often quiet moves have been successful or
 /// unsuccessful during the current search, and is used for reduction and move
@@ -95,12 +118,12 @@ typedef Stats<Move, NOT_USED, PIECE_NB, SQUARE_NB> CounterMoveHistory;
 typedef Stats<int16_t, 10692, PIECE_NB, SQUARE_NB, PIECE_TYPE_NB> CapturePieceToHistory;
 
 /// PieceToHistory is like ButterflyHistory but is addressed by a move's [piece][to]
-typedef Stats<int16_t, 29952, PIECE_NB, SQUARE_NB> PieceToHistory;
+typedef PieceStats<Stats<int16_t, 29952, SQUARE_NB>> PieceToHistory;
 
 /// ContinuationHistory is the combined history of a given pair of moves, usually
 /// the current one given a previous one. The nested history table is based on
 /// PieceToHistory instead of ButterflyBoards.
-typedef Stats<PieceToHistory, NOT_USED, PIECE_NB, SQUARE_NB> ContinuationHistory;
+typedef PieceStats<Stats<PieceToHistory, NOT_USED, SQUARE_NB>> ContinuationHistory;
 
 
 /// MovePicker class is used to pick one pseudo legal move at a time from the
@@ -127,6 +150,10 @@ public:
                                            Move,
                                            Move*);
   Move next_move(bool skipQuiets = false);
+  bool see_ge(Move m, Value threshold = VALUE_ZERO);
+
+  // Quiets are picked lazily, without sorting, up to this depth
+  static Depth LazyDepth;
 
 private:
   template<PickType T, typename Pred> Move select(Pred);
@@ -145,6 +172,8 @@ private:
   Square recaptureSquare;
   Value threshold;
   Depth depth;
+  Move seeMove = MOVE_NONE; // Known bounds on the SEE value of seeMove: seeLo <= SEE < seeHi
+  Value seeLo, seeHi;
   ExtMove moves[MAX_MOVES];
 };
 
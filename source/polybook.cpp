@@ -18,14 +18,28 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+
+#include "movegen.h"
 #include "polybook.h"
 #include "uci.h"
-#include "movegen.h"
 #include "thread.h"
 #include <iostream>
 #include "misc.h"
 #include <sys/timeb.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
 PolyBook polybook;  // global PolyBook
 
 using namespace std;
@@ -304,92 +318,305 @@ const union {
     } };
 
 
-PolyBook::PolyBook()
+BookIndex::BookIndex() : entries(NULL), count(0), baseAddress(NULL), mapping(0),
+                         prefixShift(64), prefixReady(false), stopBuild(false)
 {
-    keycount = 0;
-    polyhash = NULL;
+}
 
-    use_best_book_move = true;
-    max_book_depth = 255;
-    book_depth_count = 0;
 
-    last_position = 0;
-    akt_position = 0;
-    last_anz_pieces = 0;
-    akt_anz_pieces = 0;
-    search_counter = 0;
-       
-    do_search = true;
-    enabled = false;
+BookIndex::~BookIndex()
+{
+    close();
 }
 
 
-PolyBook::~PolyBook()
+// BookIndex::open() memory maps the book read-only and shared, so that opening
+// it costs nothing whatever its size and all the engine processes running on
+// the same host use the same page cache copy. Entries are stored big-endian in
+// the file and converted on access by key_at(), move_at() and weight_at().
+
+bool BookIndex::open(const std::string& fname)
 {
-    if (polyhash != NULL)
-        delete[]polyhash;
+    close();
+
+    const char* file_name = fname.c_str();
+
+#ifndef _WIN32
+    struct stat statbuf;
+    int fd = ::open(file_name, O_RDONLY);
+
+    if (fd == -1)
+        return false;
+
+    fstat(fd, &statbuf);
+    mapping = statbuf.st_size;
+    baseAddress = statbuf.st_size ? mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+
+    if (baseAddress == MAP_FAILED)
+    {
+        baseAddress = NULL;
+        return false;
+    }
+
+#ifdef MADV_RANDOM
+    madvise(baseAddress, mapping, MADV_RANDOM); // Binary search, avoid useless read-ahead
+#endif
+
+    count = size_t(mapping / sizeof(PolyHash));
+#else
+    HANDLE fd = CreateFile(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (fd == INVALID_HANDLE_VALUE)
+        return false;
+
+    DWORD size_high;
+    DWORD size_low = GetFileSize(fd, &size_high);
+    uint64_t size = (uint64_t(size_high) << 32) | size_low;
+    HANDLE mmap = size ? CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high, size_low, nullptr) : nullptr;
+    CloseHandle(fd);
+
+    if (!mmap)
+        return false;
+
+    baseAddress = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
+
+    if (!baseAddress)
+    {
+        CloseHandle(mmap);
+        return false;
+    }
+
+    mapping = (uint64_t)mmap;
+    count = size_t(size / sizeof(PolyHash));
+#endif
+
+    entries = (const PolyHash*)baseAddress;
+
+    // Build the prefix table in the background, probes fall back on a search
+    // over the whole book until it is ready.
+    if (count > 1 && count < 0xFFFFFFFF)
+    {
+        stopBuild = false;
+        builder = std::thread(&BookIndex::build_prefix, this);
+    }
+
+    return true;
 }
 
 
-void PolyBook::init(const std::string& bookfile)
+void BookIndex::close()
 {
-    if (bookfile.length() == 0) return;
-    const char *file_name = bookfile.c_str();
+    stopBuild = true;
+
+    if (builder.joinable())
+        builder.join();
+
+    prefixReady = false;
+    prefix.clear();
 
-    if (strcmp(file_name, "<empty>") == 0)
+    if (baseAddress != NULL)
     {
-        enabled = false;
-        return;
+#ifndef _WIN32
+        munmap(baseAddress, mapping);
+#else
+        UnmapViewOfFile(baseAddress);
+        CloseHandle((HANDLE)mapping);
+#endif
     }
 
-#ifdef _WIN32
-	FILE *fpt;
-	errno_t errno_local = fopen_s(&fpt, file_name, "rb");
-	if (fpt == NULL || errno_local != 0)
-	{
-		assert(errno_local != 0);
-#else
-    FILE *fpt = fopen(file_name, "rb");
-    if (fpt == NULL)
+    baseAddress = NULL;
+    entries = NULL;
+    mapping = 0;
+    count = 0;
+}
+
+
+// BookIndex::build_prefix() fills the prefix table with one sequential pass over
+// the book: prefix[p] is the index of the first entry whose top key bits are
+// not lower than p, so the entries of a key are all in [prefix[p], prefix[p+1])
+// with p the top bits of the key. There are about as many buckets as entries,
+// hence a probe reads one or two entries that share a cache line.
+
+void BookIndex::build_prefix()
+{
+    int bits = 1;
+    while (bits < 20 && (size_t(1) << (bits + 1)) <= count)
+        bits++;
+
+    std::vector<uint32_t> p((size_t(1) << bits) + 1);
+    size_t b = 0;
+
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL)
+    madvise(baseAddress, mapping, MADV_SEQUENTIAL);
+#endif
+
+    for (size_t i = 0; i < count; ++i)
     {
+        if ((i & 0xFFFF) == 0 && stopBuild)
+            return;
+
+        size_t kb = size_t(key_at(i) >> (64 - bits));
+        while (b <= kb)
+            p[b++] = uint32_t(i);
+    }
+
+    while (b < p.size())
+        p[b++] = uint32_t(count);
+
+#if !defined(_WIN32) && defined(MADV_RANDOM)
+    madvise(baseAddress, mapping, MADV_RANDOM);
 #endif
-        sync_cout << "info string Could not open " << bookfile << sync_endl;
-        enabled = false;
-        return;
+
+    prefix.swap(p);
+    prefixShift = 64 - bits;
+    prefixReady.store(true, std::memory_order_release);
+}
+
+
+// BookIndex::lower_bound() returns the first index in [lo, hi) whose key is not
+// lower than the given one, or hi. Polyglot keys are uniformly distributed, so
+// we interpolate the position of the key instead of bisecting, which finds it
+// in a couple of steps. A bisection step is added whenever interpolation fails
+// to halve the range, to bound the worst case on unusual books.
+
+size_t BookIndex::lower_bound(uint64_t key, size_t lo, size_t hi) const
+{
+    while (hi - lo > 8)
+    {
+        uint64_t kl = key_at(lo), kh = key_at(hi - 1);
+
+        if (key <= kl)
+            return lo;
+
+        if (key > kh)
+            return hi;
+
+        size_t range = hi - lo;
+        size_t mid = lo + size_t(double(key - kl) / double(kh - kl) * double(range - 1));
+        mid = std::min(std::max(mid, lo), hi - 1);
+
+        if (key_at(mid) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+
+        if (hi - lo > range / 2)
+        {
+            mid = lo + (hi - lo) / 2;
+
+            if (key_at(mid) < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
     }
 
-    if (polyhash != NULL)
+    while (lo < hi && key_at(lo) < key)
+        lo++;
+
+    return lo;
+}
+
+
+// BookIndex::find_first() returns the index of the first entry with the given
+// key, or size() if the key is not in the book.
+
+size_t BookIndex::find_first(uint64_t key) const
+{
+    size_t lo = 0, hi = count;
+
+    if (prefixReady.load(std::memory_order_acquire))
     {
-        free(polyhash);
-        polyhash = NULL;
+        size_t b = size_t(key >> prefixShift);
+        lo = prefix[b], hi = prefix[b + 1];
     }
 
-    fseek(fpt, 0L, SEEK_END);
-    int filesize = ftell(fpt);
-    fseek(fpt, 0L, SEEK_SET);
+    size_t i = lower_bound(key, lo, hi);
+
+    return i < count && key_at(i) == key ? i : count;
+}
 
-    keycount = filesize / 16;
-    polyhash = new PolyHash[keycount];
 
-    fread(polyhash, 1, filesize, fpt);
-    fclose(fpt);
+PolyBook::PolyBook()
+{
+    max_book_depth = 255;
+    book_depth_count = 0;
 
-    for (int i = 0; i<keycount; i++)
-        byteswap_polyhash(&polyhash[i]);
+    last_position = 0;
+    akt_position = 0;
+    last_anz_pieces = 0;
+    akt_anz_pieces = 0;
+    search_counter = 0;
+       
+    do_search = true;
 
     sr = time(NULL);
     for (int i = 0; i < 10; i++)
         rand64();
+}
+
+
+PolyBook::~PolyBook()
+{
+}
+
+
+// PolyBook::init() rebuilds the list of books from the UCI options, sorted in
+// probe order. It is called at startup and whenever one of the book options
+// changes, books that stay in the list keep their mapping and prefix table.
+
+void PolyBook::init()
+{
+    std::vector<std::unique_ptr<Book>> loaded;
+
+    if (Options["OwnBook"])
+        add_book(loaded, Options["Book File"], Options["Best Book Move"], Options["Book Priority"]);
 
-    sync_cout << "info string Book loaded: " << bookfile << sync_endl;
+    if (Options["Book_Enabled"])
+        add_book(loaded, Options["BookFile"], Options["BestBookMove"], Options["BookPriority"]);
 
-    enabled = true;
+    std::stable_sort(loaded.begin(), loaded.end(),
+                     [](const std::unique_ptr<Book>& a, const std::unique_ptr<Book>& b) {
+                         return a->priority > b->priority; });
+
+    books.swap(loaded); // Books no longer in use are closed here
 }
 
 
-void PolyBook::set_best_book_move(bool best_book_move)
+void PolyBook::add_book(std::vector<std::unique_ptr<Book>>& loaded, const std::string& fname, bool bestMove, int priority)
 {
-    use_best_book_move = best_book_move;
+    if (fname.empty() || fname == "<empty>")
+        return;
+
+    for (const auto& b : loaded)
+        if (b->fileName == fname)
+            return;
+
+    auto it = std::find_if(books.begin(), books.end(),
+                           [&](const std::unique_ptr<Book>& b) { return b && b->fileName == fname; });
+
+    if (it != books.end())
+        loaded.push_back(std::move(*it));
+    else
+    {
+        std::unique_ptr<Book> b(new Book);
+
+        if (!b->index.open(fname) || b->index.size() == 0)
+        {
+            sync_cout << "info string Could not open " << fname << sync_endl;
+            return;
+        }
+
+        sync_cout << "info string Book loaded: " << fname << sync_endl;
+
+        b->fileName = fname;
+        loaded.push_back(std::move(b));
+    }
+
+    loaded.back()->bestMove = bestMove;
+    loaded.back()->priority = priority;
 }
 
 
@@ -399,11 +626,14 @@ void PolyBook::set_book_depth(int book_depth)
 }
 
 
-Move PolyBook::probe(Position& pos)
+// PolyBook::probe() returns a book move for the root position, or MOVE_NONE. The
+// returned move is always one of the given root moves.
+
+Move PolyBook::probe(Position& pos, const Search::RootMoves& rootMoves)
 {
     Move m1 = MOVE_NONE;
 
-    if (!enabled) return m1;
+    if (books.empty()) return m1;
     if (!check_do_search(pos)) return m1;   
 
     if (book_depth_count >= max_book_depth)
@@ -411,7 +641,15 @@ Move PolyBook::probe(Position& pos)
 
     Key key = polyglot_key(pos);
 
-    int n = find_first_key(key);
+    const Book* book = nullptr;
+    int n = -1;
+
+    for (const auto& b : books)
+        if ((n = find_first_key(b->index, key)) > 0)
+        {
+            book = b.get();
+            break;
+        }
 
     if (n < 1)
     {
@@ -431,13 +669,14 @@ Move PolyBook::probe(Position& pos)
     book_depth_count++;
 
     int idx1;
-    if (use_best_book_move)
+    if (book->bestMove)
         idx1 = index_best;
     else
         idx1 = index_rand;
    
-    m1 = pg_move_to_sf_move(pos, polyhash[idx1].move);
+    m1 = pg_move_to_sf_move(book->index.move_at(idx1), rootMoves);
 
+    if (!m1) return m1;
     if (!pos.is_draw(64)) return m1;
     if (n == 1) return m1;
                 
@@ -449,15 +688,62 @@ Move PolyBook::probe(Position& pos)
     int idx2 = index_first;
     if (idx1 == idx2)
         idx2 = index_first + 1;   
-    Move  m2 = pg_move_to_sf_move(pos, polyhash[idx2].move);
+    Move  m2 = pg_move_to_sf_move(book->index.move_at(idx2), rootMoves);
     
-    if (!check_draw(m2, pos))
+    if (m2 && !check_draw(m2, pos))
         return m2;
         
     return MOVE_NONE;
 }
 
 
+/// PolyBook::in_book() tells whether the position is in one of the books. It is
+/// a plain lookup, without the book depth and the search counters of probe().
+
+bool PolyBook::in_book(const Position& pos)
+{
+    Key key = polyglot_key(pos);
+
+    for (const auto& b : books)
+        if (find_first_key(b->index, key) > 0)
+            return true;
+
+    return false;
+}
+
+
+/// PolyBook::book_moves() appends the moves of the first book that knows the
+/// position, with their weights. Unlike probe(), it changes no state of the
+/// books, so that it can be used to look ahead.
+
+void PolyBook::book_moves(const Position& pos, std::vector<std::pair<Move, int>>& moves)
+{
+    Key key = polyglot_key(pos);
+
+    for (const auto& b : books)
+    {
+        size_t i = b->index.find_first(key);
+
+        if (i == b->index.size())
+            continue;
+
+        Search::RootMoves legalMoves;
+        for (const auto& m : MoveList<LEGAL>(pos))
+            legalMoves.emplace_back(m);
+
+        for ( ; i < b->index.size() && b->index.key_at(i) == key; ++i)
+        {
+            Move m = pg_move_to_sf_move(b->index.move_at(i), legalMoves);
+
+            if (m)
+                moves.emplace_back(m, b->index.weight_at(i));
+        }
+
+        return;
+    }
+}
+
+
 Key PolyBook::polyglot_key(const Position & pos)
 {
     Key key = 0;
@@ -502,18 +788,21 @@ Key PolyBook::polyglot_key(const Position & pos)
 // bit  6-11: origin square (from 0 to 63)
 // bit 12-13: promotion piece type - 2 (from KNIGHT-2 to QUEEN-2)
 // bit 14-15: special move flag: promotion (1), en passant (2), castling (3)
-Move PolyBook::pg_move_to_sf_move(const Position & pos, unsigned short pg_move)
+Move PolyBook::pg_move_to_sf_move(unsigned short pg_move, const Search::RootMoves& rootMoves)
 {
     Move move = Move(pg_move);
       
     int pt = (move >> 12) & 7;
     if (pt)
-        return make<PROMOTION>(from_sq(move), to_sq(move), PieceType(pt + 1));
+        move = make<PROMOTION>(from_sq(move), to_sq(move), PieceType(pt + 1));
   
-    // Add 'special move' flags and verify it is legal
-    for (const auto& m : MoveList<LEGAL>(pos))
+    // Add 'special move' flags and verify it is legal. The root moves are the
+    // legal moves already generated for the search, no need to generate again.
+    for (const auto& rm : rootMoves)
     {
-        if (move == (m.move & (~(3 << 14))))  //  compare with MoveType (bit 14-15)  masked out
+        Move m = rm.pv[0];
+
+        if (m == move || (!pt && move == Move(m & ~(3 << 14))))  //  compare with MoveType (bit 14-15)  masked out
             return m;
     }
 
@@ -521,7 +810,7 @@ Move PolyBook::pg_move_to_sf_move(const Position & pos, unsigned short pg_move)
 }
 
 
-int PolyBook::find_first_key(uint64_t key)
+int PolyBook::find_first_key(const BookIndex& index, uint64_t key)
 {
     index_first = -1;
     index_count = 0;
@@ -529,64 +818,35 @@ int PolyBook::find_first_key(uint64_t key)
     index_best = -1;
     index_rand = -1;
 
-    int start = 0;
-    int end = keycount;
-
-    for (;;)
-    {
-        int mid = (end + start) / 2;
-
-        if (polyhash[mid].key < key)
-            start = mid;
-        else
-        {
-            if (polyhash[mid].key > key)
-                end = mid;
-            else
-            {
-                start = max(mid - 4, 0);
-                end = min(mid + 4, keycount);
-            }
-        }
-
-        if (end - start < 9)
-            break;
-    }
+    size_t i = index.find_first(key);
 
-    for (int i = start; i < end; i++)
-    {
-        if (key == polyhash[i].key)
-        {
-            index_first = i;
-            while ((index_first>0) && (key == polyhash[index_first - 1].key))
-                index_first--;
-            return get_key_data();
-        }
-    }
+    if (i == index.size())
+        return -1;
 
-    return -1;
+    index_first = int(i);
+    return get_key_data(index);
 }
 
 
-int PolyBook::get_key_data()
+int PolyBook::get_key_data(const BookIndex& index)
 {
-    int best_weight = polyhash[index_first].weight;
+    int best_weight = index.weight_at(index_first);
     index_weight_count = best_weight;
-    uint64_t key = polyhash[index_first].key;
+    uint64_t key = index.key_at(index_first);
 
     index_count = 1;
     index_best = index_first;
 
-    for (int i = index_first + 1; i<keycount; i++)
+    for (int i = index_first + 1; i < int(index.size()); i++)
     {
-        if (polyhash[i].key != key)
+        if (index.key_at(i) != key)
             break;
 
         index_count++;
-        index_weight_count += polyhash[i].weight;
-        if (polyhash[i].weight > best_weight)
+        index_weight_count += index.weight_at(i);
+        if (index.weight_at(i) > best_weight)
         {
-            best_weight = polyhash[i].weight;
+            best_weight = index.weight_at(i);
             index_best = i;
         }
     }
@@ -597,12 +857,12 @@ int PolyBook::get_key_data()
 
     for (int i = index_first; i < index_first + index_count; i++)
     {
-        if ((rand_pos >= weight_count) && (rand_pos < weight_count + polyhash[i].weight))
+        if ((rand_pos >= weight_count) && (rand_pos < weight_count + index.weight_at(i)))
         {
             index_rand = i;
             break;
         }
-        weight_count += polyhash[i].weight;
+        weight_count += index.weight_at(i);
     }
 
     return index_count;
@@ -652,15 +912,21 @@ bool PolyBook::check_draw(Move m, Position & pos)
 }
 
 
-void PolyBook::byteswap_polyhash(PolyHash *ph)
+uint64_t BookIndex::key_at(size_t i) const
 {
-    if (is_little_endian())
-    {
-        ph->key = swap_uint64(ph->key);
-        ph->move = swap_uint16(ph->move);
-        ph->weight = swap_uint16(ph->weight);
-        ph->learn = swap_uint32(ph->learn);
-    }
+    return is_little_endian() ? swap_uint64(entries[i].key) : entries[i].key;
+}
+
+
+uint16_t BookIndex::move_at(size_t i) const
+{
+    return is_little_endian() ? swap_uint16(entries[i].move) : entries[i].move;
+}
+
+
+uint16_t BookIndex::weight_at(size_t i) const
+{
+    return is_little_endian() ? swap_uint16(entries[i].weight) : entries[i].weight;
 }
 
 
@@ -671,14 +937,14 @@ uint64_t PolyBook::rand64()
 }
 
 
-bool PolyBook::is_little_endian()
+bool BookIndex::is_little_endian()
 {
     int num = 1;
     return (*(uint8_t *)&num == 1);
 }
 
 
-uint64_t PolyBook::swap_uint64(uint64_t d)
+uint64_t BookIndex::swap_uint64(uint64_t d)
 {
     uint64_t a;
     uint8_t *dst = (uint8_t *)&a;
@@ -697,22 +963,7 @@ uint64_t PolyBook::swap_uint64(uint64_t d)
 }
 
 
-uint32_t PolyBook::swap_uint32(uint32_t d)
-{
-    uint32_t a;
-    uint8_t *dst = (uint8_t *)&a;
-    uint8_t *src = (uint8_t *)&d;
-
-    dst[0] = src[3];
-    dst[1] = src[2];
-    dst[2] = src[1];
-    dst[3] = src[0];
-
-    return a;
-}
-
-
-uint16_t PolyBook::swap_uint16(uint16_t d)
+uint16_t BookIndex::swap_uint16(uint16_t d)
 {
     uint16_t a;
     uint8_t *dst = (uint8_t *)&a;
@@ -21,8 +21,15 @@
 #ifndef POLYBOOK_H_INCLUDED
 #define POLYBOOK_H_INCLUDED
 
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "bitboard.h"
 #include "position.h"
+#include "search.h"
 #include "string.h"
 
 typedef struct {
@@ -32,6 +39,58 @@ typedef struct {
     uint32_t learn;
 } PolyHash;
 
+
+/// BookIndex gives read access to a Polyglot book file, which is memory mapped
+/// read-only and shared. It keeps an in-memory prefix table on the top bits of
+/// the keys, built in the background after opening, so that a lookup costs
+/// about one cache miss and no system calls.
+
+class BookIndex
+{
+public:
+
+    BookIndex();
+    ~BookIndex();
+
+    bool open(const std::string& fname);
+    void close();
+
+    size_t size() const { return count; }
+    size_t find_first(uint64_t key) const;
+
+    uint64_t key_at(size_t i) const;
+    uint16_t move_at(size_t i) const;
+    uint16_t weight_at(size_t i) const;
+
+private:
+
+    void build_prefix();
+    size_t lower_bound(uint64_t key, size_t lo, size_t hi) const;
+
+    static bool is_little_endian();
+    static uint64_t swap_uint64(uint64_t d);
+    static uint16_t swap_uint16(uint16_t d);
+
+    const PolyHash* entries; // Points into the mapped file, entries are big-endian
+    size_t count;
+    void* baseAddress;
+    uint64_t mapping;        // Mapped size on POSIX, mapping handle on Windows
+
+    int prefixShift;
+    std::vector<uint32_t> prefix;
+    std::atomic<bool> prefixReady, stopBuild;
+    std::thread builder;
+};
+
+
+/// PolyBook is the opening book subsystem used by the search. It holds every
+/// configured book open across games: the "Book File" book when OwnBook is set
+/// and the "BookFile" book when Book_Enabled is set. They are probed by
+/// decreasing priority ("Book Priority" and "BookPriority"), in that order when
+/// equal. The first book that knows the position gives the move, picked by
+/// weight or as the best one according to its own option. Books are only mapped
+/// again when their file name changes.
+
 class PolyBook
 {
 public:
@@ -39,35 +98,37 @@ public:
     PolyBook();
     ~PolyBook();
 
-    void init(const std::string& bookfile);
-    void set_best_book_move(bool best_book_move);
+    void init();
     void set_book_depth(int book_depth);
 
-    Move probe(Position& pos);
+    Move probe(Position& pos, const Search::RootMoves& rootMoves);
+    bool in_book(const Position& pos);
+    void book_moves(const Position& pos, std::vector<std::pair<Move, int>>& moves);
 
 private:
 
+    struct Book {
+        std::string fileName;
+        bool bestMove;
+        int priority;
+        BookIndex index;
+    };
+
+    void add_book(std::vector<std::unique_ptr<Book>>& loaded, const std::string& fname, bool bestMove, int priority);
+
     Key polyglot_key(const Position& pos);
-    Move pg_move_to_sf_move(const Position & pos, unsigned short pg_move);
+    Move pg_move_to_sf_move(unsigned short pg_move, const Search::RootMoves& rootMoves);
 
-    int find_first_key(uint64_t key);
-    int get_key_data();
+    int find_first_key(const BookIndex& index, uint64_t key);
+    int get_key_data(const BookIndex& index);
 
     bool check_do_search(const Position & pos);
     bool check_draw(Move m, Position& pos);
 
-    void byteswap_polyhash(PolyHash *ph);
     uint64_t rand64();
 
-    bool is_little_endian();
-    uint64_t swap_uint64(uint64_t d);
-    uint32_t swap_uint32(uint32_t d);
-    uint16_t swap_uint16(uint16_t d);
-
-    int keycount;
-    PolyHash *polyhash;
+    std::vector<std::unique_ptr<Book>> books;
 
-    bool use_best_book_move;
     int max_book_depth;
     int book_depth_count;
 
@@ -85,7 +146,7 @@ private:
     int akt_anz_pieces;
     int search_counter;
 
-    bool enabled, do_search;
+    bool do_search;
 };
 
 extern PolyBook polybook;
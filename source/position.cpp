@@ -193,6 +193,35 @@ void Position::init() {
 }
 
 
+/// Position::set() overload to clone a position for another thread, without the
+/// round trip through a FEN string. The clone shares the StateInfo of the source
+/// position, which must not be modified while the clone is in use: do_move()
+/// always writes to a new StateInfo, so the search is fine with this.
+
+Position& Position::set(const Position& pos, Thread* th) {
+
+  std::copy(std::begin(pos.board), std::end(pos.board), board);
+  std::copy(std::begin(pos.byTypeBB), std::end(pos.byTypeBB), byTypeBB);
+  std::copy(std::begin(pos.byColorBB), std::end(pos.byColorBB), byColorBB);
+  std::copy(std::begin(pos.pieceCount), std::end(pos.pieceCount), pieceCount);
+  std::copy(&pos.pieceList[0][0], &pos.pieceList[0][0] + PIECE_NB * 16, &pieceList[0][0]);
+  std::copy(std::begin(pos.index), std::end(pos.index), index);
+  std::copy(std::begin(pos.castlingRightsMask), std::end(pos.castlingRightsMask), castlingRightsMask);
+  std::copy(std::begin(pos.castlingRookSquare), std::end(pos.castlingRookSquare), castlingRookSquare);
+  std::copy(std::begin(pos.castlingPath), std::end(pos.castlingPath), castlingPath);
+  gamePly = pos.gamePly;
+  sideToMove = pos.sideToMove;
+  psq = pos.psq;
+  st = pos.st;
+  chess960 = pos.chess960;
+  thisThread = th;
+
+  assert(pos_is_ok());
+
+  return *this;
+}
+
+
 /// Position::set() initializes the position object with the given FEN string.
 /// This function is not very robust - make sure that input FENs are correct,
 /// this is assumed to be the responsibility of the GUI.
@@ -351,12 +380,28 @@ void Position::set_castling_right(Color c, Square rfrom) {
 }
 
 
-/// Position::set_check_info() sets king attacks to detect if a move gives check
+/// Position::set_check_info() sets king attacks to detect if a move gives check.
+/// The blockers and pinners of a king can only change when the squares touched
+/// by the last move lie on its lines, otherwise they are copied from the
+/// previous state instead of being computed again.
 
-void Position::set_check_info(StateInfo* si) const {
+void Position::set_check_info(StateInfo* si, Bitboard touched) const {
 
-  si->blockersForKing[WHITE] = slider_blockers(pieces(BLACK), square<KING>(WHITE), si->pinners[BLACK]);
-  si->blockersForKing[BLACK] = slider_blockers(pieces(WHITE), square<KING>(BLACK), si->pinners[WHITE]);
+  if (PseudoAttacks[QUEEN][square<KING>(WHITE)] & touched)
+      si->blockersForKing[WHITE] = slider_blockers(pieces(BLACK), square<KING>(WHITE), si->pinners[BLACK]);
+  else
+  {
+      si->blockersForKing[WHITE] = si->previous->blockersForKing[WHITE];
+      si->pinners[BLACK] = si->previous->pinners[BLACK];
+  }
+
+  if (PseudoAttacks[QUEEN][square<KING>(BLACK)] & touched)
+      si->blockersForKing[BLACK] = slider_blockers(pieces(WHITE), square<KING>(BLACK), si->pinners[WHITE]);
+  else
+  {
+      si->blockersForKing[BLACK] = si->previous->blockersForKing[BLACK];
+      si->pinners[WHITE] = si->previous->pinners[WHITE];
+  }
 
   Square ksq = square<KING>(~sideToMove);
 
@@ -713,7 +758,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   assert(is_ok(m));
   assert(&newSt != st);
 
-  thisThread->nodes.fetch_add(1, std::memory_order_relaxed);
+  Thread::count(thisThread->nodes);
   Key k = st->key ^ Zobrist::side;
 
   // Copy some fields of the old state to our new StateInfo object except the
@@ -774,6 +819,10 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
           }
 
           st->pawnKey ^= Zobrist::psq[captured][capsq];
+
+          // A pawn move updates the pawn key again, and prefetches then
+          if (type_of(pc) != PAWN)
+              prefetch2(thisThread->pawnsTable[st->pawnKey]);
       }
       else
           st->nonPawnMaterial[them] -= PieceValue[MG][captured];
@@ -838,6 +887,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
           st->pawnKey ^= Zobrist::psq[pc][to];
           st->materialKey ^=  Zobrist::psq[promotion][pieceCount[promotion]-1]
                             ^ Zobrist::psq[pc][pieceCount[pc]];
+          prefetch(thisThread->materialTable[st->materialKey]);
 
           // Update material
           st->nonPawnMaterial[us] += PieceValue[MG][promotion];
@@ -862,8 +912,11 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
   sideToMove = ~sideToMove;
 
-  // Update king attacks used for fast check detection
-  set_check_info(st);
+  // Update king attacks used for fast check detection. A king move always
+  // touches the lines of its new square, castling is not worth the detail.
+  set_check_info(st,  type_of(m) == CASTLING  ? AllSquares
+                    : type_of(m) == ENPASSANT ? SquareBB[from] | to | (to - pawn_push(us))
+                                              : SquareBB[from] | to);
 
   assert(pos_is_ok());
 }
@@ -1011,6 +1064,17 @@ Key Position::key_after(Move m) const {
 }
 
 
+/// Position::material_key_after() computes the material key after the given
+/// piece is captured. Used to look for the tablebases a capture leads to.
+
+Key Position::material_key_after(Piece captured) const {
+
+  assert(pieceCount[captured] > 0);
+
+  return st->materialKey ^ Zobrist::psq[captured][pieceCount[captured] - 1];
+}
+
+
 /// Position::see_ge (Static Exchange Evaluation Greater or Equal) tests if the
 /// SEE value of move is greater or equal to the given threshold. We'll use an
 /// algorithm similar to alpha-beta pruning with a null window.
@@ -58,8 +58,9 @@ struct StateInfo {
 /// A list to keep track of the position states along the setup moves (from the
 /// start position to the position just before the search starts). Needed by
 /// 'draw by repetition' detection. Use a std::deque because pointers to
-/// elements are not invalidated upon list resizing.
-typedef std::unique_ptr<std::deque<StateInfo>> StateListPtr;
+/// elements are not invalidated upon list resizing. The list is shared by the
+/// UCI loop, which may extend it, and the search, which only reads it.
+typedef std::shared_ptr<std::deque<StateInfo>> StateListPtr;
 
 
 /// Position class stores information regarding the board representation as
@@ -79,6 +80,7 @@ public:
   // FEN string input/output
   Position& set(const std::string& fenStr, bool isChess960, StateInfo* si, Thread* th);
   Position& set(const std::string& code, Color c, StateInfo* si);
+  Position& set(const Position& pos, Thread* th);
   const std::string fen() const;
 
   // Position representation
@@ -143,6 +145,7 @@ public:
   Key key() const;
   Key key_after(Move m) const;
   Key material_key() const;
+  Key material_key_after(Piece captured) const;
   Key pawn_key() const;
 
   // Other properties of the position
@@ -166,7 +169,7 @@ private:
   // Initialization helpers (used while setting up a position)
   void set_castling_right(Color c, Square rfrom);
   void set_state(StateInfo* si) const;
-  void set_check_info(StateInfo* si) const;
+  void set_check_info(StateInfo* si, Bitboard touched = AllSquares) const;
 
   // Other helpers
   void put_piece(Piece pc, Square s);
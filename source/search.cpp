@@ -26,8 +26,8 @@
 #include <iostream>
 #include <sstream>
 #include <random>
-#include "book.h"
 #include "evaluate.h"
+#include "learn.h"
 #include "misc.h"
 #include "movegen.h"
 #include "movepick.h"
@@ -41,13 +41,6 @@
 #include "syzygy/tbprobe.h"
 
 int Options_Junior_Depth;
-bool Options_Junior_Mobility;
-bool Options_Junior_King;
-bool Options_Junior_Threats;
-bool Options_Junior_Passed;
-bool Options_Junior_Space;
-bool Options_Junior_Initiative;
-bool Options_Shashin_Strategy;
 
 namespace Search {
 
@@ -57,6 +50,7 @@ namespace Search {
 namespace Tablebases {
 
   int Cardinality;
+  bool Prefetch;
   bool RootInTB;
   bool UseRule50;
   Depth ProbeDepth;
@@ -108,9 +102,38 @@ namespace {
     Move best = MOVE_NONE;
   };
   
-  bool doNull, cleanSearch, bookEnabled;
+  bool doNull, cleanSearch;
   int tactical, variety;
 
+  // Ways of diversifying the helper threads, selected by the "SMP Policy" option
+  enum SmpPolicy { SMP_SKIP_BLOCKS, SMP_DEPTH_OFFSET, SMP_ASPIRATION };
+  const char* SmpPolicyNames[] = { "Skip Blocks", "Depth Offset", "Aspiration" };
+  SmpPolicy smpPolicy;
+
+  std::string smp_report();
+
+  // Throttling of the intermediate info lines, set by "Info Lines Per Second"
+  TimePoint infoInterval, lastInfo;
+  bool infoPending;
+
+  // info_allowed() tells whether an intermediate info line may be sent now.
+  // A suppressed PV is remembered, so that the final one is sent before the
+  // "bestmove" even if nothing else would have printed it.
+  bool info_allowed(bool pv, bool force = false) {
+
+    TimePoint elapsed = Time.elapsed();
+
+    if (!force && infoInterval && elapsed - lastInfo < infoInterval)
+    {
+        infoPending |= pv;
+        return false;
+    }
+
+    lastInfo = elapsed;
+    infoPending &= !pv;
+    return true;
+  }
+
   template <NodeType NT>
   Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode);
 
@@ -124,6 +147,19 @@ namespace {
   void update_quiet_stats(const Position& pos, Stack* ss, Move move, Move* quiets, int quietsCnt, int bonus);
   void update_capture_stats(const Position& pos, Move move, Move* captures, int captureCnt, int bonus);
 
+  // Counts one TT probe in TTProbeSample in the thread statistics
+  inline void count_tt_probe(Thread* th, const TTEntry* tte, bool ttHit) {
+
+    if (++th->ttProbeTick % TTProbeSample)
+        return;
+
+    Thread::count(th->ttProbes);
+    if (ttHit)
+        Thread::count(th->ttHits);
+    else if (!tte->empty())
+        Thread::count(th->ttReplacements);
+  }
+
   inline bool gives_check(const Position& pos, Move move) {
     Color us = pos.side_to_move();
     return  type_of(move) == NORMAL && !(pos.blockers_for_king(~us) & pos.pieces(us))
@@ -131,32 +167,108 @@ namespace {
           : pos.gives_check(move);
   }
 
+  // smp_report() returns, as UCI info strings, the iterations completed by
+  // each thread and the fraction of them that another thread also completed,
+  // which would be wasted work if the helpers had nothing else to give.
+
+  std::string smp_report() {
+
+    std::stringstream ss;
+    std::bitset<MAX_PLY> all;
+    size_t iterations = 0;
+
+    for (size_t i = 0; i < Threads.size(); ++i)
+    {
+        std::bitset<MAX_PLY> others;
+
+        for (Thread* th : Threads)
+            if (th != Threads[i])
+                others |= th->completedDepths;
+
+        const std::bitset<MAX_PLY>& mine = Threads[i]->completedDepths;
+        size_t n = mine.count();
+
+        ss << "info string thread " << i
+           << " depth " << Threads[i]->completedDepth / ONE_PLY
+           << " iterations " << n
+           << " overlap " << (n ? 100 * (mine & others).count() / n : 0) << "%\n";
+
+        iterations += n;
+        all |= mine;
+    }
+
+    ss << "info string smp policy " << SmpPolicyNames[smpPolicy]
+       << " iterations " << iterations
+       << " distinct depths " << all.count()
+       << " main depth " << Threads.main()->completedDepth / ONE_PLY
+       << " time " << Time.elapsed();
+
+    return ss.str();
+  }
+
+
+  // Perft uses a hash table of its own, shared by the threads. Entries are
+  // lockless: the key, mixed with the depth, is stored xor'ed with the count.
+  struct PerftEntry {
+    std::atomic<uint64_t> keyXorCount, count;
+  };
+
+  constexpr size_t PerftTableSize = 1 << 20; // 16 MiB
+  std::unique_ptr<PerftEntry[]> perftTable;
+  std::atomic<size_t> perftNextMove;
+  std::vector<uint64_t> perftCounts;
+
   // perft() is our utility to verify move generation. All the leaf nodes up
   // to the given depth are generated and counted, and the sum is returned.
-  template<bool Root>
+  // The last ply is bulk counted, and subtrees found in the hash are not
+  // walked again.
   uint64_t perft(Position& pos, Depth depth) {
 
+    if (depth < ONE_PLY)
+        return 1;
+
+    if (depth == ONE_PLY)
+        return MoveList<LEGAL>(pos).size();
+
+    Key key = pos.key() ^ (uint64_t(depth) * 0x9E3779B97F4A7C15ULL);
+    PerftEntry& e = perftTable[size_t(key) & (PerftTableSize - 1)];
+    uint64_t cnt = e.count.load(std::memory_order_relaxed);
+
+    if (cnt && (e.keyXorCount.load(std::memory_order_relaxed) ^ cnt) == key)
+        return cnt;
+
     StateInfo st;
-    uint64_t cnt, nodes = 0;
-    const bool leaf = (depth == 2 * ONE_PLY);
+    uint64_t nodes = 0;
 
     for (const auto& m : MoveList<LEGAL>(pos))
     {
-        if (Root && depth <= ONE_PLY)
-            cnt = 1, nodes++;
-        else
-        {
-            pos.do_move(m, st);
-            cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - ONE_PLY);
-            nodes += cnt;
-            pos.undo_move(m);
-        }
-        if (Root)
-            sync_cout << UCI::move(m, pos.is_chess960()) << ": " << cnt << sync_endl;
+        pos.do_move(m, st);
+        nodes += perft(pos, depth - ONE_PLY);
+        pos.undo_move(m);
     }
+
+    e.keyXorCount.store(key ^ nodes, std::memory_order_relaxed);
+    e.count.store(nodes, std::memory_order_relaxed);
     return nodes;
   }
 
+  // perft_root() is run by all the threads. Each one takes the next root move
+  // not taken yet, until there are none left, and counts its subtree.
+  void perft_root(Thread* th, Depth depth) {
+
+    StateInfo st;
+    size_t i;
+
+    while ((i = perftNextMove++) < th->rootMoves.size())
+    {
+        Move m = th->rootMoves[i].pv[0];
+
+        th->rootPos.do_move(m, st);
+        perftCounts[i] = perft(th->rootPos, depth - ONE_PLY);
+        th->rootPos.undo_move(m);
+    }
+  }
+
 } // namespace
 
 
@@ -208,16 +320,44 @@ void Search::clear() {
 
 void MainThread::search() {
 
+  resumeDepth = DEPTH_ZERO; // Until this search completes
+
   if (Limits.perft)
   {
-      nodes = perft<true>(rootPos, Limits.perft * ONE_PLY);
-      sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
+      perftTable.reset(new PerftEntry[PerftTableSize]());
+      perftCounts.assign(rootMoves.size(), 0);
+      perftNextMove = 0;
+
+      for (Thread* th : Threads)
+          if (th != this)
+              th->start_searching();
+
+      perft_root(this, Limits.perft * ONE_PLY);
+
+      for (Thread* th : Threads)
+          if (th != this)
+              th->wait_for_search_finished();
+
+      std::stringstream ss;
+      uint64_t total = 0;
+      TimePoint elapsed = now() - Limits.startTime + 1;
+
+      for (size_t i = 0; i < rootMoves.size(); ++i)
+      {
+          ss << UCI::move(rootMoves[i].pv[0], rootPos.is_chess960()) << ": " << perftCounts[i] << "\n";
+          total += perftCounts[i];
+      }
+
+      perftTable.reset();
+      nodes = total;
+
+      sync_cout << ss.str()
+                << "\nNodes searched: " << total
+                << "\nTime (ms): " << elapsed
+                << "\nNodes/second: " << 1000 * total / elapsed << "\n" << sync_endl;
       return;
   }
 
-  static PolyglotBook book; // Defined static to initialize the PRNG only once
-
-  bookEnabled = Options["Book_Enabled"];
   Color us = rootPos.side_to_move();
   Time.init(Limits, us, rootPos.game_ply());
 //Hash			  
@@ -229,58 +369,62 @@ void MainThread::search() {
 
   // Read search options
   doNull = Options["NullMove"];
+  smpPolicy =  Options["SMP Policy"] == "Depth Offset" ? SMP_DEPTH_OFFSET
+             : Options["SMP Policy"] == "Aspiration"   ? SMP_ASPIRATION
+                                                       : SMP_SKIP_BLOCKS;
   tactical = Options["Tactical Mode"];
+  infoInterval = int(Options["Info Lines Per Second"]) ? 1000 / int(Options["Info Lines Per Second"]) : 0;
+  lastInfo = -infoInterval;
+  infoPending = false;
   variety = Options["Variety"];
   
   Options_Junior_Depth = Options["Junior Depth"];
-  Options_Junior_Mobility = Options["Junior Mobility"];
-  Options_Junior_King = Options["Junior King"];
-  Options_Junior_Threats = Options["Junior Threats"];
-  Options_Junior_Passed = Options["Junior Passed"];
-  Options_Junior_Space = Options["Junior Space"];
-  Options_Junior_Initiative = Options["Junior Initiative"];
-  Options_Shashin_Strategy = Options["Shashin Strategy"];
+  MovePicker::LazyDepth = int(Options["Lazy Quiet Depth"]) * ONE_PLY;
+  Eval::set_terms(  (Options["Junior Mobility"]   ? Eval::TERM_MOBILITY   : 0)
+                  | (Options["Junior King"]       ? Eval::TERM_KING       : 0)
+                  | (Options["Junior Threats"]    ? Eval::TERM_THREATS    : 0)
+                  | (Options["Junior Passed"]     ? Eval::TERM_PASSED     : 0)
+                  | (Options["Junior Space"]      ? Eval::TERM_SPACE      : 0)
+                  | (Options["Junior Initiative"] ? Eval::TERM_INITIATIVE : 0));
  
+  Move bookMove = MOVE_NONE;
+
   if (rootMoves.empty())
   {
       rootMoves.emplace_back(MOVE_NONE);
-      sync_cout << "info depth 0 score "
-                << UCI::value(rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW)
-                << sync_endl;
+      Output::push("info depth 0 score "
+                   + UCI::value(rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW));
   }
   else
   {
-      if (bool(Options["OwnBook"]) && !Limits.infinite && !Limits.mate)
-      {
-          Move bookMove = book.probe(rootPos, Options["Book File"], Options["Best Book Line"]);
+      if (!Limits.infinite && !Limits.mate)
+          bookMove = polybook.probe(rootPos, rootMoves);
 
-          if (bookMove && std::count(rootMoves.begin(), rootMoves.end(), bookMove))
-          {
-              std::swap(rootMoves[0], *std::find(rootMoves.begin(), rootMoves.end(), bookMove));
-              goto finalize;
-          }
-      }
-		Move bookMove = MOVE_NONE;
-		
-		if (!Limits.infinite && !Limits.mate)
-		bookMove = polybook.probe(rootPos);
-		
-		if (bookEnabled && bookMove && std::count(rootMoves.begin(), rootMoves.end(), bookMove))
-		{
-			for (Thread* th : Threads)
-				std::swap(th->rootMoves[0], *std::find(th->rootMoves.begin(), th->rootMoves.end(), bookMove));
-		}
-		else
-		{
+      // The helpers do not search a book move, so only our root moves matter
+      if (bookMove)
+          std::swap(rootMoves[0], *std::find(rootMoves.begin(), rootMoves.end(), bookMove));
+      else
+      {
           for (Thread* th : Threads)
               if (th != this)
                   th->start_searching();
 
+          if (Threads.deterministic)
+              wait_turn();
+
           Thread::search(); // Let's start searching!
+
+          // Stop the helpers in our turn, while they wait at a known point
+          if (Threads.deterministic)
+          {
+              if (!Threads.ponder && !Limits.infinite)
+                  Threads.stop = true;
+
+              pass_turn(true);
+          }
       }
   }
 
-finalize:
   // When we reach the maximum depth, we can arrive here without a raise of
   // Threads.stop. However, if we are pondering or in an infinite search,
   // the UCI protocol states that we shouldn't print the best move before the
@@ -288,8 +432,7 @@ finalize:
   // until the GUI sends one of those commands (which also raises Threads.stop).
   Threads.stopOnPonderhit = true;
 
-  while (!Threads.stop && (Threads.ponder || Limits.infinite))
-  {} // Busy wait for a stop or a ponder reset
+  Threads.wait_for_stop(); // Sleep until a stop or a ponder reset
 
   // Stop the threads if not already stopped (also raise the stop if
   // "ponderhit" just reset Threads.ponder).
@@ -300,6 +443,9 @@ finalize:
       if (th != this)
           th->wait_for_search_finished();
 
+  if (Threads.size() > 1 && Options["SMP Report"])
+      Output::push(smp_report());
+
   // When playing in 'nodes as time' mode, subtract the searched nodes from
   // the available ones before exiting.
   if (Limits.npmsec)
@@ -310,6 +456,7 @@ finalize:
   if (    int(Options["MultiPV"]) == 1
       && !Limits.depth
       && !Skill(int(Options["Skill Level"])).enabled()
+      && !bookMove
       &&  rootMoves[0].pv[0] != MOVE_NONE)
   {
       for (Thread* th : Threads)
@@ -325,17 +472,177 @@ finalize:
   }
 
   previousScore = bestThread->rootMoves[0].score;
+  lastBestThread = bestThread;
 
-  // Send again PV info if we have a new best thread
-  if (bestThread != this)
-      sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
+  if (!bookMove && bestThread->rootMoves[0].pv[0] != MOVE_NONE)
+  {
+      const RootMove& rm = bestThread->rootMoves[0];
+      resumePv = rm.pv;
+      resumeScore = rm.score != -VALUE_INFINITE ? rm.score : rm.previousScore;
+      resumeDepth = bestThread->completedDepth;
+  }
 
-  sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
+  // Send again PV info if we have a new best thread, or if the last one was
+  // held back by the info throttle.
+  if (bestThread != this || infoPending)
+      Output::push(UCI::pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE));
+
+  if (Options["TT Stats"])
+      Output::push(TT.stats());
+
+  std::string bestmove = "bestmove " + UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
 
   if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
-      std::cout << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
+      bestmove += " ponder " + UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
+
+  // Warm up while the GUI waits for the opponent's move. From here on, any
+  // stop is meant for the warm-up. Only games on a clock have such a wait,
+  // batch runs would block on the warm-up instead.
+  bool warmUp =   bookMove
+               && int(Options["Book Warmup Depth"])
+               && Limits.use_time_management()
+               && !Output::Muted;
+
+  if (warmUp)
+      Threads.warming = true, Threads.stop = false;
+
+  Output::push(std::move(bestmove));
+
+  if (Limits.use_time_management())
+      Time.log(Limits, us, rootPos.game_ply(), bestThread->completedDepth, bestThread->rootMoves[0].score);
+
+  if (warmUp)
+      warm_up(bookMove);
+}
+
+
+namespace {
+
+  // A position where the book ends, by the line that leads to it from the root
+  // and the probability of that line according to the book weights.
+  struct BookExit {
+    std::vector<Move> line;
+    double p;
+  };
+
+  constexpr int BookExitPlies = 8;
+  constexpr size_t BookExitCount = 8;
+  constexpr double BookExitMinP = 0.01;
+
+  void book_exits(Position& pos, std::vector<Move>& line, double p, int plies, std::vector<BookExit>& exits) {
+
+    std::vector<std::pair<Move, int>> moves;
+    polybook.book_moves(pos, moves);
+
+    if (moves.empty())
+    {
+        exits.push_back({ line, p });
+        return;
+    }
+
+    if (!plies)
+        return;
+
+    int total = 0;
+    for (const auto& m : moves)
+        total += m.second;
+
+    for (const auto& m : moves)
+    {
+        double q = p * (total ? double(m.second) / total : 1.0 / moves.size());
+
+        if (q < BookExitMinP)
+            continue;
+
+        StateInfo st;
+        pos.do_move(m.first, st);
+        line.push_back(m.first);
+        book_exits(pos, line, q, plies - 1, exits);
+        line.pop_back();
+        pos.undo_move(m.first);
+    }
+  }
+
+} // namespace
+
+
+/// MainThread::warm_up() runs after a book move has been played, with the
+/// "Book Warmup Depth" option set. It follows the book lines from the position
+/// after the move to the positions where the book ends, and searches the most
+/// likely of them to the given depth, without output, until a command arrives.
+/// So the first search out of book finds a TT filled with its subtree. The root
+/// and the results of the last search are restored for the UCI commands that
+/// read them.
+
+void MainThread::warm_up(Move bookMove) {
+
+  // The helpers were not started for the book move, so we search alone, and
+  // must not hand a deterministic turn over to one of them.
+  Threads.deterministic = false;
+
+  for (Thread* th : Threads)
+      th->inTurns = false;
+
+  Search::LimitsType limits = Limits;
+  Value score = previousScore;
+  double reduction = previousTimeReduction;
+  Depth depth = completedDepth;
+  RootMoves moves = rootMoves;
+
+  std::vector<BookExit> exits;
+  std::vector<Move> line(1, bookMove);
+  StateInfo st;
+  Position pos;
+
+  pos.set(Threads.rootPosition, this);
+  pos.do_move(bookMove, st);
+  book_exits(pos, line, 1.0, BookExitPlies, exits);
+
+  std::stable_sort(exits.begin(), exits.end(),
+                   [](const BookExit& a, const BookExit& b) { return a.p > b.p; });
+
+  exits.resize(std::min(exits.size(), BookExitCount));
+  Output::Muted = true;
+
+  for (const BookExit& e : exits)
+  {
+      if (Threads.stop)
+          break;
+
+      std::deque<StateInfo> states(e.line.size());
+      Position exitPos;
+      exitPos.set(Threads.rootPosition, this);
+
+      for (size_t i = 0; i < e.line.size(); ++i)
+          exitPos.do_move(e.line[i], states[i]);
+
+      rootPos.set(exitPos, this);
+      rootMoves.clear();
+
+      for (const auto& m : MoveList<LEGAL>(rootPos))
+          rootMoves.emplace_back(m);
+
+      if (rootMoves.empty())
+          continue;
+
+      Search::LimitsType warmLimits;
+      warmLimits.depth = Options["Book Warmup Depth"];
+      warmLimits.startTime = now();
+      Limits = warmLimits;
+      rootDepth = completedDepth = DEPTH_ZERO;
+
+      Thread::search();
+  }
 
-  std::cout << sync_endl;
+  Output::Muted = false;
+
+  rootPos.set(Threads.rootPosition, this);
+  rootMoves = moves;
+  completedDepth = depth;
+  previousTimeReduction = reduction;
+  previousScore = score;
+  Limits = limits;
+  Threads.warming = false;
 }
 
 
@@ -345,6 +652,12 @@ finalize:
 
 void Thread::search() {
 
+  if (Limits.perft) // Helping the main thread with its perft
+  {
+      perft_root(this, Limits.perft * ONE_PLY);
+      return;
+  }
+
   Stack stack[MAX_PLY+7], *ss = stack+4; // To reference from (ss-4) to (ss+2)
   Value bestValue, alpha, beta, delta;
   Move  lastBestMove = MOVE_NONE;
@@ -353,6 +666,8 @@ void Thread::search() {
   double timeReduction = 1.0;
   Color us = rootPos.side_to_move();
   bool failedLow;
+  Value lastIterationValue = VALUE_NONE;
+  TimePoint iterationStart = 0, lastIterationTime = 0, previousIterationTime = 0;
 
   std::memset(ss-4, 0, 7 * sizeof(Stack));
   for (int i = 4; i > 0; i--)
@@ -380,6 +695,36 @@ void Thread::search() {
 
   multiPV = std::min(multiPV, rootMoves.size());
 
+  // With "MultiPV Null Window" the secondary lines are first searched with a
+  // null window at their previous score, and only a fail high is searched
+  // again with an aspiration window. The helpers also share out the secondary
+  // lines: each one searches the first line, then the lines from its own offset.
+  bool nullWindowLines = multiPV > 1 && Options["MultiPV Null Window"];
+  size_t helperFirstLine = idx > 0 && nullWindowLines ? 1 + (idx - 1) % (multiPV - 1) : 1;
+
+  // Start from what was learned in earlier sessions about this position: the
+  // learned move is searched first, and the main thread seeds the TT with it.
+  Move learnMove;
+  Value learnValue;
+  Depth learnDepth;
+
+  if (Learning.probe(rootPos.key(), learnMove, learnValue, learnDepth))
+  {
+      auto rm = std::find(rootMoves.begin(), rootMoves.end(), learnMove);
+
+      if (rm != rootMoves.end() && rm->tbRank == rootMoves[0].tbRank)
+      {
+          std::rotate(rootMoves.begin(), rm, rm + 1);
+
+          bool ttHit;
+          TTEntry* tte = TT.probe(rootPos.key(), ttHit);
+
+          if (mainThread && (!ttHit || tte->depth() < learnDepth))
+              tte->save(rootPos.key(), learnValue, BOUND_EXACT, learnDepth,
+                        learnMove, VALUE_NONE, TT.generation());
+      }
+  }
+
   int ct = int(Options["Contempt"]) * PawnValueEg / 100; // From centipawns
 
   // In analysis mode, adjust contempt in accordance with user preference
@@ -401,16 +746,26 @@ void Thread::search() {
          && !(Limits.depth && mainThread && rootDepth / ONE_PLY > Limits.depth))
   {
       // Distribute search depths across the helper threads
-      if (idx > 0)
+      if (idx > 0 && smpPolicy == SMP_SKIP_BLOCKS)
       {
           int i = (idx - 1) % 20;
           if (((rootDepth / ONE_PLY + SkipPhase[i]) / SkipSize[i]) % 2)
               continue;  // Retry with an incremented rootDepth
       }
 
+      // Or keep the helpers 1 to 4 plies ahead of the main thread, so that
+      // they do not repeat the iterations it has already completed.
+      if (   idx > 0
+          && smpPolicy == SMP_DEPTH_OFFSET
+          && rootDepth <= Threads.main()->completedDepth + int((idx - 1) % 4) * ONE_PLY)
+          continue;
+
       // Age out PV variability metric
       if (mainThread)
+      {
           mainThread->bestMoveChanges *= 0.517, failedLow = false;
+          iterationStart = Time.elapsed();
+      }
 
       // Save the last iteration's scores before first PV line is searched and
       // all the move scores except the (new) PV are set to -VALUE_INFINITE.
@@ -431,17 +786,34 @@ void Thread::search() {
                       break;
           }
 
+          // Skipped lines keep their scores of the last iteration that searched them
+          if (pvIdx > 0 && pvIdx < helperFirstLine && rootDepth > ONE_PLY)
+              continue;
+
           // Reset UCI info selDepth for each depth and each PV line
           selDepth = 0;
+          bool nullWindow = false;
 
           // Reset aspiration window starting size
           if (rootDepth >= 5 * ONE_PLY)
           {
               Value previousScore = rootMoves[pvIdx].previousScore;
               delta = Value(18);
+
+              // Or search all depths but with a window size depending on idx
+              if (idx > 0 && smpPolicy == SMP_ASPIRATION)
+                  delta += Value(6 * int((idx - 1) % 8));
               alpha = std::max(previousScore - delta,-VALUE_INFINITE);
               beta  = std::min(previousScore + delta, VALUE_INFINITE);
 
+              // Is a secondary line still better than its previous score?
+              if (nullWindowLines && pvIdx > 0 && previousScore != -VALUE_INFINITE)
+              {
+                  nullWindow = true;
+                  alpha = previousScore - 1;
+                  beta  = previousScore;
+              }
+
               // Adjust contempt based on root move's previousScore (dynamic contempt)
               int dct = ct + 88 * previousScore / (abs(previousScore) + 200);
 
@@ -475,8 +847,22 @@ void Thread::search() {
               if (   mainThread
                   && multiPV == 1
                   && (bestValue <= alpha || bestValue >= beta)
-                  && Time.elapsed() > 3000)
-                  sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
+                  && Time.elapsed() > 3000
+                  && info_allowed(true))
+                  Output::push(UCI::pv(rootPos, rootDepth, alpha, beta));
+
+              // A fail low of the null window search is kept as an upper bound,
+              // a fail high is searched again from there.
+              if (nullWindow)
+              {
+                  nullWindow = false;
+
+                  if (bestValue <= alpha)
+                      break;
+
+                  beta = std::min(bestValue + delta, VALUE_INFINITE);
+                  continue;
+              }
 
               // In case of failing low/high increase aspiration window and
               // re-search, otherwise exit the loop.
@@ -501,16 +887,31 @@ void Thread::search() {
               assert(alpha >= -VALUE_INFINITE && beta <= VALUE_INFINITE);
           }
 
+          // Keep the bound of the line's score, a fail low of the null window
+          // search included, so that it is reported whatever place the line
+          // takes once sorted.
+          RootMove& line = rootMoves[pvIdx];
+          if (line.score != -VALUE_INFINITE)
+              line.bound =  line.score >= beta  ? BOUND_LOWER
+                          : line.score <= alpha ? BOUND_UPPER : BOUND_EXACT;
+
           // Sort the PV lines searched so far and update the GUI
           std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
 
           if (    mainThread
-              && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
-              sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
+              && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000)
+              && info_allowed(true, Threads.stop))
+              Output::push(UCI::pv(rootPos, rootDepth, -VALUE_INFINITE, VALUE_INFINITE));
       }
 
       if (!Threads.stop)
+      {
           completedDepth = rootDepth;
+          completedDepths.set(rootDepth / ONE_PLY);
+
+          if (Limits.searchmoves.empty())
+              Learning.store(rootPos.key(), rootMoves[0].pv[0], rootMoves[0].score, rootDepth);
+      }
 
       if (rootMoves[0].pv[0] != lastBestMove) {
          lastBestMove = rootMoves[0].pv[0];
@@ -521,7 +922,10 @@ void Thread::search() {
       if (   Limits.mate
           && bestValue >= VALUE_MATE_IN_MAX_PLY
           && VALUE_MATE - bestValue <= 2 * Limits.mate)
+      {
           Threads.stop = true;
+          Threads.notify_stop(); // The main thread may be waiting already
+      }
 
       if (!mainThread)
           continue;
@@ -535,24 +939,26 @@ void Thread::search() {
           && !Threads.stop
           && !Threads.stopOnPonderhit)
           {
-              const int F[] = { failedLow,
-                                bestValue - mainThread->previousScore };
+              previousIterationTime = lastIterationTime;
+              lastIterationTime = Time.elapsed() - iterationStart;
 
-              int improvingFactor = std::max(246, std::min(832, 306 + 119 * F[0] - 6 * F[1]));
+              uint64_t rootNodes = 0;
+              for (const RootMove& rm : rootMoves)
+                  rootNodes += rm.nodes;
 
-              // If the bestMove is stable over several iterations, reduce time accordingly
-              timeReduction = 1.0;
-              for (int i : {3, 4, 5})
-                  if (lastBestMoveDepth * i < completedDepth)
-                     timeReduction *= 1.25;
+              IterationStats iter = { completedDepth, lastBestMoveDepth,
+                                      bestValue, mainThread->previousScore, lastIterationValue,
+                                      failedLow, mainThread->bestMoveChanges,
+                                      mainThread->previousTimeReduction,
+                                      rootMoves[0].nodes, rootNodes,
+                                      lastIterationTime, previousIterationTime };
 
-              // Use part of the gained time from a previous stable move for the current move
-              double bestMoveInstability = 1.0 + mainThread->bestMoveChanges;
-              bestMoveInstability *= std::pow(mainThread->previousTimeReduction, 0.528) / timeReduction;
+              lastIterationValue = bestValue;
 
               // Stop the search if we have only one legal move, or if available time elapsed
-              if (   rootMoves.size() == 1
-                  || Time.elapsed() > Time.optimum() * bestMoveInstability * improvingFactor / 581)
+              bool timeUp = Time.stop_iterating(iter, timeReduction);
+
+              if (rootMoves.size() == 1 || timeUp)
               {
                   // If we are allowed to ponder do not stop the search now but
                   // keep pondering until the GUI sends "ponderhit" or "stop".
@@ -632,6 +1038,9 @@ namespace {
     if (thisThread == Threads.main())
         static_cast<MainThread*>(thisThread)->check_time();
 
+    if (Threads.deterministic && thisThread->nodes.load(std::memory_order_relaxed) >= thisThread->turnEnd)
+        thisThread->pass_turn(false);
+
     // Used to send selDepth info to GUI (selDepth counts from 1, ply from 0)
     if (PvNode && thisThread->selDepth < ss->ply + 1)
         thisThread->selDepth = ss->ply + 1;
@@ -677,6 +1086,7 @@ namespace {
     excludedMove = ss->excludedMove;
     posKey = pos.key() ^ Key(excludedMove << 16); // Isn't a very good hash
     tte = TT.probe(posKey, ttHit);
+    count_tt_probe(thisThread, tte, ttHit);
     ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
     ttMove =  rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
             : ttHit    ? tte->move() : MOVE_NONE;
@@ -709,6 +1119,7 @@ namespace {
                 update_continuation_histories(ss, pos.moved_piece(ttMove), to_sq(ttMove), penalty);
             }
         }
+        STATS_COUNT(thisThread, STAT_TT_CUTOFF);
         return ttValue;
     }
 
@@ -727,7 +1138,7 @@ namespace {
 
             if (err != TB::ProbeState::FAIL)
             {
-                thisThread->tbHits.fetch_add(1, std::memory_order_relaxed);
+                Thread::count(thisThread->tbHits);
 
                 int drawScore = TB::UseRule50 ? 1 : 0;
 
@@ -757,6 +1168,11 @@ namespace {
                 }
             }
         }
+
+        // Not probed yet, but the search is in the tablebase range or one capture
+        // away from it: let the files be mapped and read ahead in the background.
+        else if (TB::Prefetch && piecesCount <= TB::Cardinality + 1)
+            Tablebases::prefetch(pos);
     }
 
     // Step 6. Static evaluation of the position
@@ -840,7 +1256,10 @@ namespace {
                 nullValue = beta;
 
             if (thisThread->nmpMinPly || (abs(beta) < VALUE_KNOWN_WIN && depth < 12 * ONE_PLY))
+            {
+                STATS_COUNT(thisThread, STAT_NULL_PRUNE);
                 return nullValue;
+            }
 
             assert(!thisThread->nmpMinPly); // Recursive verification is not allowed
 
@@ -854,7 +1273,10 @@ namespace {
             thisThread->nmpMinPly = 0;
 
             if (v >= beta)
+            {
+                STATS_COUNT(thisThread, STAT_NULL_PRUNE);
                 return nullValue;
+            }
         }
     }
 
@@ -942,10 +1364,10 @@ moves_loop: // When in check, search starts from here
 
       ss->moveCount = ++moveCount;
 
-      if (rootNode && thisThread == Threads.main() && Time.elapsed() > 3000)
-          sync_cout << "info depth " << depth / ONE_PLY
-                    << " currmove " << UCI::move(move, pos.is_chess960())
-                    << " currmovenumber " << moveCount + thisThread->pvIdx << sync_endl;
+      if (rootNode && thisThread == Threads.main() && Time.elapsed() > 3000 && info_allowed(false))
+          Output::push("info depth " + std::to_string(depth / ONE_PLY)
+                     + " currmove " + UCI::move(move, pos.is_chess960())
+                     + " currmovenumber " + std::to_string(moveCount + thisThread->pvIdx));
       if (PvNode)
           (ss+1)->pv = nullptr;
 
@@ -983,7 +1405,7 @@ moves_loop: // When in check, search starts from here
       }
       else if (    givesCheck // Check extension (~2 Elo)
                && !moveCountPruning
-               &&  pos.see_ge(move))
+               &&  mp.see_ge(move))
           extension = ONE_PLY;
 
       // Calculate new depth for this move
@@ -1021,11 +1443,11 @@ moves_loop: // When in check, search starts from here
                   continue;
 
               // Prune moves with negative SEE (~10 Elo)
-              if (!pos.see_ge(move, Value(-29 * lmrDepth * lmrDepth)))
+              if (!mp.see_ge(move, Value(-29 * lmrDepth * lmrDepth)))
                   continue;
           }
           else if (   !extension // (~20 Elo)
-                   && !pos.see_ge(move, -PawnValueEg * (depth / ONE_PLY)))
+                   && !mp.see_ge(move, -PawnValueEg * (depth / ONE_PLY)))
                   continue;
       }
 
@@ -1047,6 +1469,7 @@ moves_loop: // When in check, search starts from here
       ss->continuationHistory = thisThread->continuationHistory[movedPiece][to_sq(move)].get();
 
       // Step 15. Make the move
+      uint64_t nodeCount = rootNode ? thisThread->nodes.load(std::memory_order_relaxed) : 0;
       pos.do_move(move, st, givesCheck);
 
       // Step 16. Reduced depth search (LMR). If the move fails high it will be
@@ -1110,6 +1533,9 @@ moves_loop: // When in check, search starts from here
           value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, d, true);
 
           doFullDepthSearch = (value > alpha && d != newDepth);
+
+          if (doFullDepthSearch)
+              STATS_COUNT(thisThread, STAT_LMR_RESEARCH);
       }
       else
           doFullDepthSearch = !PvNode || moveCount > 1;
@@ -1146,6 +1572,8 @@ moves_loop: // When in check, search starts from here
           RootMove& rm = *std::find(thisThread->rootMoves.begin(),
                                     thisThread->rootMoves.end(), move);
 
+          rm.nodes += thisThread->nodes.load(std::memory_order_relaxed) - nodeCount;
+
           // PV move or new best move?
           if (moveCount == 1 || value > alpha)
           {
@@ -1290,6 +1718,7 @@ moves_loop: // When in check, search starts from here
     ss->continuationHistory = thisThread->continuationHistory[NO_PIECE][0].get();
     inCheck = pos.checkers();
     moveCount = 0;
+    STATS_COUNT(thisThread, STAT_QSEARCH_NODE);
 
     // Check for an immediate draw or maximum ply reached
     if (   pos.is_draw(ss->ply)
@@ -1306,6 +1735,7 @@ moves_loop: // When in check, search starts from here
     // Transposition table lookup
     posKey = pos.key();
     tte = TT.probe(posKey, ttHit);
+    count_tt_probe(thisThread, tte, ttHit);
     ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
     ttMove = ttHit ? tte->move() : MOVE_NONE;
 
@@ -1315,7 +1745,10 @@ moves_loop: // When in check, search starts from here
         && ttValue != VALUE_NONE // Only in case of TT access race
         && (ttValue >= beta ? (tte->bound() & BOUND_LOWER)
                             : (tte->bound() & BOUND_UPPER)))
+    {
+        STATS_COUNT(thisThread, STAT_TT_CUTOFF);
         return ttValue;
+    }
 
     // Evaluate the position statically
     if (inCheck)
@@ -1393,7 +1826,7 @@ moves_loop: // When in check, search starts from here
               continue;
           }
 
-          if (futilityBase <= alpha && !pos.see_ge(move, VALUE_ZERO + 1))
+          if (futilityBase <= alpha && !mp.see_ge(move, VALUE_ZERO + 1))
           {
               bestValue = std::max(bestValue, futilityBase);
               continue;
@@ -1408,7 +1841,7 @@ moves_loop: // When in check, search starts from here
 
       // Don't search moves with negative SEE values
       if (  (!inCheck || evasionPrunable)
-          && !pos.see_ge(move))
+          && !mp.see_ge(move))
           continue;
 
       // Speculative prefetch as early as possible
@@ -1636,11 +2069,85 @@ void MainThread::check_time() {
 
   if (   (Limits.use_time_management() && elapsed > Time.maximum() - 10)
       || (Limits.movetime && elapsed >= Limits.movetime)
-      || (Limits.nodes && Threads.nodes_searched() >= (uint64_t)Limits.nodes))
+      || (Limits.nodes && nodes_limit_reached(tick)))
       Threads.stop = true;
 }
 
 
+/// MainThread::resume() seeds the root moves of a new search from the last one,
+/// when the new root is the last root or is reached from it by the first one or
+/// two moves of its PV, as after a ponder hit or a step forward in an analysis.
+/// The PV move goes first with the last score, which centres the first aspiration
+/// window, and since the TT still holds the subtree the iterations start at half
+/// the depth left to the PV. Returns the depth to start from.
+
+Depth MainThread::resume(const Position& pos, Search::RootMoves& seeds) {
+
+  if (resumeDepth < 4 * ONE_PLY)
+      return DEPTH_ZERO;
+
+  StateInfo st[2];
+  Value v = resumeScore;
+  size_t plies = 0;
+
+  // Walk down the PV from the last root, which is still set up in rootPos
+  while (   rootPos.key() != pos.key()
+         && plies < 2
+         && plies + 1 < resumePv.size()
+         && rootPos.pseudo_legal(resumePv[plies])
+         && rootPos.legal(resumePv[plies]))
+  {
+      rootPos.do_move(resumePv[plies], st[plies]);
+      ++plies, v = -v;
+  }
+
+  bool found = rootPos.key() == pos.key();
+
+  for (size_t i = plies; i > 0; --i)
+      rootPos.undo_move(resumePv[i - 1]);
+
+  if (!found)
+      return DEPTH_ZERO;
+
+  auto rm = std::find(seeds.begin(), seeds.end(), resumePv[plies]);
+
+  if (rm == seeds.end() || rm->tbRank != seeds[0].tbRank)
+      return DEPTH_ZERO;
+
+  std::rotate(seeds.begin(), rm, rm + 1);
+  seeds[0].score = seeds[0].previousScore = v;
+  seeds[0].pv.assign(resumePv.begin() + plies, resumePv.end());
+
+  Depth d = (resumeDepth - int(plies) * ONE_PLY) / 2;
+
+  return Limits.depth ? std::min(d, (Limits.depth - 1) * ONE_PLY) : d;
+}
+
+
+/// MainThread::nodes_limit_reached() checks the "go nodes" limit. Summing the
+/// counters reads a cache line of every thread, so with helper threads this is
+/// done at most once per millisecond, unless our own count, extrapolated to
+/// all the threads, says the limit may be reached before the next sample.
+
+bool MainThread::nodes_limit_reached(TimePoint tick) {
+
+  uint64_t own = nodes.load(std::memory_order_relaxed);
+
+  if (Threads.size() == 1)
+      return own >= (uint64_t)Limits.nodes;
+
+  if (Threads.deterministic) // The sum must not depend on the timing
+      return Threads.nodes_searched() >= (uint64_t)Limits.nodes;
+
+  if (   tick == lastNodesSample
+      && own * Threads.size() < (uint64_t)Limits.nodes)
+      return false;
+
+  lastNodesSample = tick;
+  return Threads.nodes_searched() >= (uint64_t)Limits.nodes;
+}
+
+
 /// UCI::pv() formats PV information according to the UCI protocol. UCI requires
 /// that all (if any) unsearched PV lines are sent using a previous search score.
 
@@ -1676,8 +2183,13 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
          << " multipv "  << i + 1
          << " score "    << UCI::value(v);
 
-      if (!tb && i == pvIdx)
-          ss << (v >= beta ? " lowerbound" : v <= alpha ? " upperbound" : "");
+      // The line being searched is bounded by its window, the others keep the
+      // bound of their last search.
+      Bound b =  i == pvIdx && updated && v >= beta  ? BOUND_LOWER
+               : i == pvIdx && updated && v <= alpha ? BOUND_UPPER : rootMoves[i].bound;
+
+      if (!tb)
+          ss << (b == BOUND_LOWER ? " lowerbound" : b == BOUND_UPPER ? " upperbound" : "");
 
       ss << " nodes "    << nodesSearched
          << " nps "      << nodesSearched * 1000 / elapsed;
@@ -1732,6 +2244,7 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
     UseRule50 = bool(Options["Syzygy50MoveRule"]);
     ProbeDepth = int(Options["SyzygyProbeDepth"]) * ONE_PLY;
     Cardinality = int(Options["SyzygyProbeLimit"]);
+    Prefetch = bool(Options["SyzygyPrefetch"]);
     bool dtz_available = true;
 
     // Tables with fewer pieces than SyzygyProbeLimit are searched with
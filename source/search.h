@@ -68,9 +68,11 @@ struct RootMove {
 
   Value score = -VALUE_INFINITE;
   Value previousScore = -VALUE_INFINITE;
+  Bound bound = BOUND_EXACT; // Of score, from the window it was searched with
   int selDepth = 0;
-  int tbRank;
+  int tbRank = 0;
   Value tbScore;
+  uint64_t nodes = 0; // Searched under this move, by its thread
   std::vector<Move> pv;
 };
 
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstring>   // For std::memset and std::memcpy
 #include <deque>
@@ -27,12 +28,15 @@
 #include <iostream>
 #include <list>
 #include <sstream>
+#include <thread>
 #include <type_traits>
 
 #include "../bitboard.h"
+#include "../misc.h"
 #include "../movegen.h"
 #include "../position.h"
 #include "../search.h"
+#include "../thread.h"
 #include "../thread_win32.h"
 #include "../types.h"
 #include "../uci.h"
@@ -53,6 +57,9 @@
 using namespace Tablebases;
 
 int Tablebases::MaxCardinality;
+#ifdef USE_STATS
+std::atomic<uint64_t> Tablebases::ProbeLatency[LatencyBuckets];
+#endif
 
 namespace {
 
@@ -263,6 +270,18 @@ public:
         return data + 4; // Skip Magics's header
     }
 
+    // Ask the OS to read the whole mapped file in the background, so that the
+    // first probes do not fault on every page. Windows has no equivalent on
+    // all the versions we support, there the table is only mapped in advance.
+    static void advise(void* baseAddress, uint64_t mapping) {
+
+#ifndef _WIN32
+        madvise(baseAddress, mapping, MADV_WILLNEED);
+#else
+        (void)baseAddress, (void)mapping;
+#endif
+    }
+
     static void unmap(void* baseAddress, uint64_t mapping) {
 
 #ifndef _WIN32
@@ -312,6 +331,7 @@ struct TBTable {
     static constexpr int Sides = Type == WDL ? 2 : 1;
 
     std::atomic_bool ready;
+    std::atomic_bool queued; // Already handed to the prefetcher
     void* baseAddress;
     uint8_t* map;
     uint64_t mapping;
@@ -327,7 +347,7 @@ struct TBTable {
         return &items[stm % Sides][hasPawns ? f : 0];
     }
 
-    TBTable() : ready(false), baseAddress(nullptr) {}
+    TBTable() : ready(false), queued(false), baseAddress(nullptr) {}
     explicit TBTable(const std::string& code);
     explicit TBTable(const TBTable<WDL>& wdl);
 
@@ -1085,43 +1105,156 @@ void set(T& e, uint8_t* data) {
         }
 }
 
+// Name of the TB file corresponding to the given position, or to the position
+// after the given piece has been captured
+template<TBType Type>
+std::string file_name(const TBTable<Type>& e, const Position& pos, Piece captured = NO_PIECE) {
+
+    // Pieces strings in decreasing order for each color, like ("KPP","KR")
+    std::string w, b;
+    for (PieceType pt = KING; pt >= PAWN; --pt) {
+        w += std::string(popcount(pos.pieces(WHITE, pt)) - (captured == make_piece(WHITE, pt)), PieceToChar[pt]);
+        b += std::string(popcount(pos.pieces(BLACK, pt)) - (captured == make_piece(BLACK, pt)), PieceToChar[pt]);
+    }
+
+    Key key = captured ? pos.material_key_after(captured) : pos.material_key();
+
+    return  (e.key == key ? w + 'v' + b : b + 'v' + w)
+          + (Type == WDL ? ".rtbw" : ".rtbz");
+}
+
+// Memory map and init the given TB file, unless already done. Function is
+// thread safe and can be called concurrently.
+template<TBType Type>
+void* map_file(TBTable<Type>& e, const std::string& fname) {
+
+    static Mutex mutex;
+
+    std::unique_lock<Mutex> lk(mutex);
+
+    if (e.ready.load(std::memory_order_relaxed)) // Recheck under lock
+        return e.baseAddress;
+
+    uint8_t* data = TBFile(fname).map(&e.baseAddress, &e.mapping, Type);
+
+    if (data)
+        set(e, data);
+
+    e.ready.store(true, std::memory_order_release);
+    return e.baseAddress;
+}
+
 // If the TB file corresponding to the given position is already memory mapped
 // then return its base address, otherwise try to memory map and init it. Called
-// at every probe, memory map and init only at first access. Function is thread
-// safe and can be called concurrently.
+// at every probe, memory map and init only at first access.
 template<TBType Type>
 void* mapped(TBTable<Type>& e, const Position& pos) {
 
-    static Mutex mutex;
-
     // Use 'aquire' to avoid a thread reads 'ready' == true while another is
     // still working, this could happen due to compiler reordering.
     if (e.ready.load(std::memory_order_acquire))
         return e.baseAddress; // Could be nullptr if file does not exsist
 
-    std::unique_lock<Mutex> lk(mutex);
+    return map_file(e, file_name(e, pos));
+}
 
-    if (e.ready.load(std::memory_order_relaxed)) // Recheck under lock
-        return e.baseAddress;
+// class Prefetcher maps WDL files and asks the OS to read them ahead, in a
+// thread of its own, when the search gets close to them. It is started at the
+// first request and stopped before the tables are destroyed.
+class Prefetcher {
 
-    // Pieces strings in decreasing order for each color, like ("KPP","KR")
-    std::string fname, w, b;
-    for (PieceType pt = KING; pt >= PAWN; --pt) {
-        w += std::string(popcount(pos.pieces(WHITE, pt)), PieceToChar[pt]);
-        b += std::string(popcount(pos.pieces(BLACK, pt)), PieceToChar[pt]);
+    std::thread worker;
+    Mutex mutex;
+    ConditionVariable cv;
+    std::deque<std::pair<TBTable<WDL>*, std::string>> queue;
+    bool exit = false;
+
+    void work() {
+
+        while (true)
+        {
+            std::unique_lock<Mutex> lk(mutex);
+            cv.wait(lk, [&]{ return exit || !queue.empty(); });
+
+            if (exit)
+                return;
+
+            auto job = queue.front();
+            queue.pop_front();
+            lk.unlock();
+
+            if (map_file(*job.first, job.second))
+                TBFile::advise(job.first->baseAddress, job.first->mapping);
+            else
+                job.first->queued = false; // Let a later request try again
+        }
     }
 
-    fname =  (e.key == pos.material_key() ? w + 'v' + b : b + 'v' + w)
-           + (Type == WDL ? ".rtbw" : ".rtbz");
+public:
+    ~Prefetcher() { stop(); }
 
-    uint8_t* data = TBFile(fname).map(&e.baseAddress, &e.mapping, Type);
+    void push(TBTable<WDL>* e, std::string&& fname) {
 
-    if (data)
-        set(e, data);
+        std::unique_lock<Mutex> lk(mutex);
 
-    e.ready.store(true, std::memory_order_release);
-    return e.baseAddress;
+        if (!worker.joinable())
+            worker = std::thread(&Prefetcher::work, this);
+
+        queue.emplace_back(e, std::move(fname));
+        cv.notify_one();
+    }
+
+    void stop() {
+
+        if (!worker.joinable())
+            return;
+
+        {
+            std::unique_lock<Mutex> lk(mutex);
+            exit = true;
+
+            for (auto& job : queue)
+                job.first->queued = false;
+
+            queue.clear();
+        }
+
+        cv.notify_one();
+        worker.join();
+        exit = false;
+    }
+};
+
+Prefetcher TBPrefetcher; // Declared after TBTables, so destroyed before it
+
+// Hand the WDL file of the given position, or of the position after the given
+// capture, to the prefetcher unless it is missing or already mapped.
+void queue_wdl(const Position& pos, Piece captured) {
+
+    Key key = captured ? pos.material_key_after(captured) : pos.material_key();
+    TBTable<WDL>* entry = TBTables.get<WDL>(key);
+
+    if (   !entry
+        ||  entry->ready.load(std::memory_order_relaxed)
+        ||  entry->queued.exchange(true))
+        return;
+
+    TBPrefetcher.push(entry, file_name(*entry, pos, captured));
+}
+
+#ifdef USE_STATS
+// Bucket of the probe latency histogram: < 1us, < 10us, ..., >= 10ms
+void record_latency(std::chrono::steady_clock::duration elapsed) {
+
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    int b = 0;
+
+    for (auto bound = 1; b < LatencyBuckets - 1 && us >= bound; bound *= 10)
+        ++b;
+
+    ProbeLatency[b].fetch_add(1, std::memory_order_relaxed);
 }
+#endif
 
 template<TBType Type, typename Ret = typename TBTable<Type>::Ret>
 Ret probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw) {
@@ -1212,6 +1345,119 @@ WDLScore search(Position& pos, ProbeState* result) {
     return *result = OK, value;
 }
 
+// The ranks of the root moves of the last probed positions, so that a "go" on
+// the same position (a ponder miss, or the next move of an analysis) does not
+// probe them again. Only accessed by the UCI thread, cleared by init().
+struct RootRanking {
+    Key key;
+    int cnt50;
+    bool rep, rule50, dtz, ok;
+    std::vector<Search::RootMove> moves;
+};
+
+constexpr size_t RootCacheSize = 8;
+RootRanking RootCache[RootCacheSize];
+size_t RootCacheNext;
+
+RootRanking* cached_ranking(const Position& pos, bool dtz, bool rule50) {
+
+    for (RootRanking& r : RootCache)
+        if (   r.key == pos.key()
+            && r.cnt50 == pos.rule50_count()
+            && r.rep == pos.has_repeated()
+            && r.rule50 == rule50
+            && r.dtz == dtz)
+            return &r;
+
+    return nullptr;
+}
+
+// Copy the ranks of a cached ranking, which must cover all the root moves
+// (a "go searchmoves" may have ranked only some of them).
+bool from_cache(const Position& pos, Search::RootMoves& rootMoves, bool dtz, bool rule50, bool& ok) {
+
+    const RootRanking* r = cached_ranking(pos, dtz, rule50);
+
+    if (!r)
+        return false;
+
+    for (auto& m : rootMoves)
+    {
+        auto it = std::find(r->moves.begin(), r->moves.end(), m.pv[0]);
+
+        if (it == r->moves.end())
+            return false;
+
+        m.tbRank  = it->tbRank;
+        m.tbScore = it->tbScore;
+    }
+
+    ok = r->ok;
+    return true;
+}
+
+void to_cache(const Position& pos, const Search::RootMoves& rootMoves, bool dtz, bool rule50, bool ok) {
+
+    RootRanking* r = cached_ranking(pos, dtz, rule50);
+
+    if (!r)
+    {
+        r = &RootCache[RootCacheNext++ % RootCacheSize];
+        r->key = pos.key();
+        r->cnt50 = pos.rule50_count();
+        r->rep = pos.has_repeated();
+        r->rule50 = rule50;
+        r->dtz = dtz;
+    }
+
+    r->ok = ok;
+    r->moves = rootMoves;
+}
+
+// probe_root_moves() calls rank(pos, m) for each root move, until one of them
+// returns false. With many root moves the probes are shared among helpers, one
+// per pool thread, each bound like the search thread with the same index and
+// with its own clone of the root position. The pool is idle at this point.
+template<typename F>
+bool probe_root_moves(Position& pos, Search::RootMoves& rootMoves, F rank) {
+
+    constexpr size_t MovesPerHelper = 4; // Not worth a helper otherwise
+
+    const size_t threadCount = std::min(Threads.size(), rootMoves.size() / MovesPerHelper);
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+
+    auto work = [&](Position& p) {
+        size_t i;
+        while (ok && (i = next++) < rootMoves.size())
+            if (!rank(p, rootMoves[i]))
+                ok = false;
+    };
+
+    if (threadCount < 2)
+    {
+        work(pos);
+        return ok;
+    }
+
+    std::vector<std::thread> helpers;
+
+    for (size_t idx = 0; idx < threadCount; ++idx)
+        helpers.emplace_back([&, idx]() {
+
+            Numa::bindThisThread(idx, threadCount);
+
+            Position p;
+            p.set(pos, Threads[idx]);
+            work(p);
+        });
+
+    for (std::thread& th : helpers)
+        th.join();
+
+    return ok;
+}
+
 } // namespace
 
 
@@ -1220,7 +1466,17 @@ WDLScore search(Position& pos, ProbeState* result) {
 /// safe, nor it needs to be.
 void Tablebases::init(const std::string& paths) {
 
+    TBPrefetcher.stop(); // Before the tables it refers to are destroyed
     TBTables.clear();
+
+    for (auto& r : RootCache)
+        r.key = 0, r.moves.clear();
+
+#ifdef USE_STATS
+    for (auto& b : ProbeLatency)
+        b = 0;
+#endif
+
     MaxCardinality = 0;
     TBFile::Paths = paths;
 
@@ -1372,8 +1628,45 @@ void Tablebases::init(const std::string& paths) {
 //  2 : win
 WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 
+#ifdef USE_STATS
+    auto start = std::chrono::steady_clock::now();
+#endif
+
     *result = OK;
-    return search<false>(pos, result);
+    WDLScore v = search<false>(pos, result);
+
+#ifdef USE_STATS
+    record_latency(std::chrono::steady_clock::now() - start);
+#endif
+    return v;
+}
+
+// Prefetch the WDL file of the given position. When the position is not in the
+// tablebases yet, prefetch the files that the side to move can reach with one
+// capture instead, so that they are ready when the search gets there. Cheap
+// enough to be called from the search.
+void Tablebases::prefetch(const Position& pos) {
+
+    if (TBTables.get<WDL>(pos.material_key()))
+    {
+        queue_wdl(pos, NO_PIECE);
+        return;
+    }
+
+    Color us = pos.side_to_move();
+    Bitboard b = pos.pieces(~us) & ~pos.pieces(KING);
+
+    while (b)
+    {
+        Square s = pop_lsb(&b);
+        Piece pc = pos.piece_on(s);
+
+        if (pos.attackers_to(s) & pos.pieces(us))
+        {
+            queue_wdl(pos, pc);
+            b &= ~pos.pieces(~us, type_of(pc)); // One file per captured type
+        }
+    }
 }
 
 // Probe the DTZ table for a particular position.
@@ -1470,8 +1763,11 @@ int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
 // A return value false indicates that not all probes were successful.
 bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves) {
 
-    ProbeState result;
-    StateInfo st;
+    bool rule50 = Options["Syzygy50MoveRule"];
+    bool ok;
+
+    if (from_cache(pos, rootMoves, true, rule50, ok))
+        return ok;
 
     // Obtain 50-move counter for the root position
     int cnt50 = pos.rule50_count();
@@ -1479,35 +1775,39 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves) {
     // Check whether a position was repeated since the last zeroing move.
     bool rep = pos.has_repeated();
 
-    int dtz, bound = Options["Syzygy50MoveRule"] ? 900 : 1;
+    int bound = rule50 ? 900 : 1;
 
     // Probe and rank each move
-    for (auto& m : rootMoves)
-    {
-        pos.do_move(m.pv[0], st);
+    ok = probe_root_moves(pos, rootMoves, [=](Position& p, Search::RootMove& m) {
+
+        ProbeState result;
+        StateInfo st;
+        int dtz;
+
+        p.do_move(m.pv[0], st);
 
         // Calculate dtz for the current move counting from the root position
-        if (pos.rule50_count() == 0)
+        if (p.rule50_count() == 0)
         {
             // In case of a zeroing move, dtz is one of -101/-1/0/1/101
-            WDLScore wdl = -probe_wdl(pos, &result);
+            WDLScore wdl = -probe_wdl(p, &result);
             dtz = dtz_before_zeroing(wdl);
         }
         else
         {
             // Otherwise, take dtz for the new position and correct by 1 ply
-            dtz = -probe_dtz(pos, &result);
+            dtz = -probe_dtz(p, &result);
             dtz =  dtz > 0 ? dtz + 1
                  : dtz < 0 ? dtz - 1 : dtz;
         }
 
         // Make sure that a mating move is assigned a dtz value of 1
-        if (   pos.checkers()
+        if (   p.checkers()
             && dtz == 2
-            && MoveList<LEGAL>(pos).size() == 0)
+            && MoveList<LEGAL>(p).size() == 0)
             dtz = 1;
 
-        pos.undo_move(m.pv[0]);
+        p.undo_move(m.pv[0]);
 
         if (result == FAIL)
             return false;
@@ -1527,9 +1827,12 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves) {
                    : r == 0     ? VALUE_DRAW
                    : r > -bound ? Value((std::min(-3, r + 800) * int(PawnValueEg)) / 200)
                    :             -VALUE_MATE + MAX_PLY + 1;
-    }
+        return true;
+    });
 
-    return true;
+    to_cache(pos, rootMoves, true, rule50, ok);
+
+    return ok;
 }
 
 
@@ -1541,19 +1844,23 @@ bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves) {
 
     static const int WDL_to_rank[] = { -1000, -899, 0, 899, 1000 };
 
-    ProbeState result;
-    StateInfo st;
-
     bool rule50 = Options["Syzygy50MoveRule"];
+    bool ok;
+
+    if (from_cache(pos, rootMoves, false, rule50, ok))
+        return ok;
 
     // Probe and rank each move
-    for (auto& m : rootMoves)
-    {
-        pos.do_move(m.pv[0], st);
+    ok = probe_root_moves(pos, rootMoves, [=](Position& p, Search::RootMove& m) {
 
-        WDLScore wdl = -probe_wdl(pos, &result);
+        ProbeState result;
+        StateInfo st;
 
-        pos.undo_move(m.pv[0]);
+        p.do_move(m.pv[0], st);
+
+        WDLScore wdl = -probe_wdl(p, &result);
+
+        p.undo_move(m.pv[0]);
 
         if (result == FAIL)
             return false;
@@ -1564,7 +1871,10 @@ bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves) {
             wdl =  wdl > WDLDraw ? WDLWin
                  : wdl < WDLDraw ? WDLLoss : WDLDraw;
         m.tbScore = WDL_to_value[wdl + 2];
-    }
+        return true;
+    });
 
-    return true;
+    to_cache(pos, rootMoves, false, rule50, ok);
+
+    return ok;
 }
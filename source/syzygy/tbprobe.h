@@ -21,6 +21,7 @@
 #ifndef TBPROBE_H
 #define TBPROBE_H
 
+#include <atomic>
 #include <ostream>
 
 #include "../search.h"
@@ -47,12 +48,19 @@ enum ProbeState {
 
 extern int MaxCardinality;
 
+#ifdef USE_STATS
+// Histogram of the WDL probe times since init(): < 1us, < 10us, ..., >= 10ms
+constexpr int LatencyBuckets = 6;
+extern std::atomic<uint64_t> ProbeLatency[LatencyBuckets];
+#endif
+
 void init(const std::string& paths);
 WDLScore probe_wdl(Position& pos, ProbeState* result);
 int probe_dtz(Position& pos, ProbeState* result);
 bool root_probe(Position& pos, Search::RootMoves& rootMoves);
 bool root_probe_wdl(Position& pos, Search::RootMoves& rootMoves);
 void rank_root_moves(Position& pos, Search::RootMoves& rootMoves);
+void prefetch(const Position& pos);
 
 inline std::ostream& operator<<(std::ostream& os, const WDLScore v) {
 
@@ -20,6 +20,7 @@
 
 #include <algorithm> // For std::count
 #include <cassert>
+#include <sstream>
 
 #include "movegen.h"
 #include "search.h"
@@ -34,7 +35,7 @@ ThreadPool Threads; // Global object
 /// Thread constructor launches the thread and waits until it goes to sleep
 /// in idle_loop(). Note that 'searching' and 'exit' should be alredy set.
 
-Thread::Thread(size_t n) : idx(n), stdThread(&Thread::idle_loop, this) {
+Thread::Thread(size_t n, size_t count) : idx(n), poolSize(count), stdThread(&Thread::idle_loop, this) {
 
   wait_for_search_finished();
 }
@@ -53,10 +54,21 @@ Thread::~Thread() {
 }
 
 
-/// Thread::clear() reset histories, usually before a new game
+/// Thread::clear() resets the histories, usually before a new game. It only
+/// flags them: the thread clears them itself before its next search, so that
+/// the threads clear in parallel, each in memory local to its NUMA node.
 
 void Thread::clear() {
 
+  historiesStale = true;
+}
+
+
+/// Thread::clear_histories() does the actual reset of the histories
+
+void Thread::clear_histories() {
+
+  historiesStale = false;
   counterMoves.fill(MOVE_NONE);
   mainHistory.fill(0);
   captureHistory.fill(0);
@@ -93,13 +105,8 @@ void Thread::wait_for_search_finished() {
 
 void Thread::idle_loop() {
 
-  // If OS already scheduled us on a different group than 0 then don't overwrite
-  // the choice, eventually we are one of many one-threaded processes running on
-  // some Windows NUMA hardware, for instance in fishtest. To make it simple,
-  // just check if running threads are below a threshold, in this case all this
-  // NUMA machinery is not needed.
-  if (int(Options["Threads"]) >= 8)
-      WinProcGroup::bindThisThread(idx);
+  // Bind to our NUMA node, see Numa::node_for() for the policy
+  numaNode = Numa::bindThisThread(idx, poolSize);
 
   while (true)
   {
@@ -113,32 +120,99 @@ void Thread::idle_loop() {
 
       lk.unlock();
 
+      // Take our own copy of the root, here rather than in start_thinking(),
+      // so that the threads set up their roots in parallel and in memory local
+      // to their NUMA node.
+      rootPos.set(Threads.rootPosition, this);
+      rootMoves = Threads.rootSeeds;
+      evalCache.resize(size_t(Options["Eval Cache"])); // No-op unless the size changed
+      pawnsTable.resize(size_t(Options["Pawn Hash"]));
+      materialTable.resize(size_t(Options["Material Hash"]));
+
+      if (historiesStale)
+          clear_histories();
+
+      // The main thread takes its turns around Thread::search()
+      if (Threads.deterministic && idx)
+          wait_turn();
+
       search();
+
+      if (Threads.deterministic && idx)
+          pass_turn(true);
   }
 }
 
+/// Thread::wait_turn() and Thread::pass_turn() make the threads search in turns,
+/// in index order and for TurnNodes nodes each, when the "Deterministic SMP"
+/// option is set. As only one thread runs at a time, each one sees the TT and
+/// the other shared data in a state that does not depend on timing, and a search
+/// limited by nodes or depth is reproduced exactly with any number of threads.
+/// The price is that the threads do not search in parallel any more.
+
+void Thread::wait_turn() {
+
+  std::unique_lock<Mutex> lk(Threads.turnMutex);
+  Threads.turnCv.wait(lk, [&]{ return Threads.turn == idx; });
+  turnEnd = nodes.load(std::memory_order_relaxed) + TurnNodes;
+}
+
+void Thread::pass_turn(bool leave) {
+
+  {
+      std::lock_guard<Mutex> lk(Threads.turnMutex);
+
+      inTurns = !leave;
+      size_t i = idx;
+
+      do i = (i + 1) % Threads.size();
+      while (!Threads[i]->inTurns && i != idx);
+
+      Threads.turn = i;
+  }
+
+  Threads.turnCv.notify_all();
+
+  if (!leave)
+      wait_turn();
+}
+
+
 /// ThreadPool::set() creates/destroys threads to match the requested number.
 /// Created and launched threads will go immediately to sleep in idle_loop.
-/// Upon resizing, threads are recreated to allow for binding if necessary.
+/// The pool grows and shrinks from its end, so that the remaining threads keep
+/// their tables and histories. Only when the binding of a remaining thread has
+/// to change, for instance when crossing the auto binding threshold, all the
+/// threads are recreated.
 
 void ThreadPool::set(size_t requested) {
 
-  if (size() > 0) { // destroy any existing thread(s)
+  if (size() > 0) // Wait for the end of any search before touching the pool
       main()->wait_for_search_finished();
 
-      while (size() > 0)
-          delete back(), pop_back();
-  }
+  bool rebind = false;
+  for (size_t i = 0; i < std::min(size(), requested); ++i)
+      rebind |= at(i)->numa_node() != Numa::node_for(i, requested);
 
-  if (requested > 0) { // create new thread(s)
-      push_back(new MainThread(0));
+  while (size() > (rebind ? 0 : requested)) // destroy extra or all thread(s)
+      delete back(), pop_back();
 
-      while (size() < requested)
-          push_back(new Thread(size()));
+  bool newPool = empty();
+
+  // Each thread is allocated from a helper bound to the node the thread will
+  // run on, and its tables are first written by the thread itself, so that the
+  // kernel places its memory on that node (first touch policy).
+  while (size() < requested) // create new thread(s)
+      std::thread([&]() {
+          size_t idx = size();
+          Numa::bindThisThread(idx, requested);
+          push_back(idx ? new Thread(idx, requested) : new MainThread(0, requested));
+      }).join();
+
+  if (newPool && requested > 0)
       clear();
-  }
 
-  // Reallocate the hash with the new threadpool size
+  // Reallocate the hash if its size changed, with the new threadpool size
   TT.resize(Options["Hash"]);
 }
 
@@ -152,28 +226,73 @@ void ThreadPool::clear() {
   main()->callsCnt = 0;
   main()->previousScore = VALUE_INFINITE;
   main()->previousTimeReduction = 1.0;
+  main()->resumeDepth = DEPTH_ZERO;
+}
+
+/// ThreadPool::wait_for_stop() blocks the main thread after its search while
+/// we are pondering or in an infinite search, until the GUI sends "stop" or
+/// "ponderhit" or a helper thread raises the stop.
+
+void ThreadPool::wait_for_stop() {
+
+  std::unique_lock<Mutex> lk(stopMutex);
+  stopCv.wait(lk, [&]{ return stop || !(ponder || Search::Limits.infinite); });
+}
+
+
+/// ThreadPool::notify_stop() wakes up wait_for_stop() after stop or ponder has
+/// been changed. Taking the mutex ensures the change is not missed by a waiter
+/// that has just checked the condition.
+
+void ThreadPool::notify_stop() {
+
+  { std::lock_guard<Mutex> lk(stopMutex); }
+  stopCv.notify_all();
 }
 
+
+/// ThreadPool::stop_warmup() stops the TT warm-up that the main thread may run
+/// after a book move, and waits for it, before any command that needs the pool.
+
+void ThreadPool::stop_warmup() {
+
+  if (warming)
+  {
+      stop = true;
+      main()->wait_for_search_finished();
+  }
+}
+
+
 /// ThreadPool::start_thinking() wakes up main thread waiting in idle_loop() and
 /// returns immediately. Main thread will wake up other threads and start the search.
 
 void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
                                 const Search::LimitsType& limits, bool ponderMode) {
 
+  stop_warmup();
   main()->wait_for_search_finished();
+  TT.allocate();
 
   stopOnPonderhit = stop = false;
   ponder = ponderMode;
   Search::Limits = limits;
-  Search::RootMoves rootMoves;
+  rootSeeds.clear();
 
   for (const auto& m : MoveList<LEGAL>(pos))
       if (   limits.searchmoves.empty()
           || std::count(limits.searchmoves.begin(), limits.searchmoves.end(), m))
-          rootMoves.emplace_back(m);
+          rootSeeds.emplace_back(m);
 
-  if (!rootMoves.empty())
-      Tablebases::rank_root_moves(pos, rootMoves);
+  if (!rootSeeds.empty())
+      Tablebases::rank_root_moves(pos, rootSeeds);
+
+  deterministic = size() > 1 && !limits.perft && Options["Deterministic SMP"];
+  turn = 0;
+
+  // Before the counters are reset, as resume() makes moves on the last root
+  Depth startDepth =  !rootSeeds.empty() && !limits.perft && Options["Search Reuse"]
+                    ? main()->resume(pos, rootSeeds) : DEPTH_ZERO;
 
   // After ownership transfer 'states' becomes empty, so if we stop the search
   // and call 'go' again without setting a new position states.get() == NULL.
@@ -182,22 +301,95 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   if (states.get())
       setupStates = std::move(states); // Ownership transfer, states is now empty
 
-  // We use Position::set() to set root position across threads. But there are
-  // some StateInfo fields (previous, pliesFromNull, capturedPiece) that cannot
-  // be deduced from a fen string, so set() clears them and to not lose the info
-  // we need to backup and later restore setupStates->back(). Note that setupStates
-  // is shared by threads but is accessed in read-only mode.
-  StateInfo tmp = setupStates->back();
+  // The root position and moves are kept here, unchanged during the search,
+  // and each thread clones them when it wakes up in idle_loop(). The clones
+  // share setupStates->back(), which is accessed in read-only mode.
+  rootPosition.set(pos, main());
 
   for (Thread* th : *this)
   {
       th->nodes = th->tbHits = th->nmpMinPly = 0;
-      th->rootDepth = th->completedDepth = DEPTH_ZERO;
-      th->rootMoves = rootMoves;
-      th->rootPos.set(pos.fen(), pos.is_chess960(), &setupStates->back(), th);
+      th->ttProbes = th->ttHits = th->ttReplacements = 0;
+      th->ttProbeTick = 0;
+      th->evalCacheProbes = th->evalCacheHits = 0;
+#ifdef USE_STATS
+      for (auto& c : th->stats)
+          c = 0;
+#endif
+      th->rootDepth = th->completedDepth = startDepth;
+      th->inTurns = true;
+      th->completedDepths.reset();
   }
 
-  setupStates->back() = tmp;
-
   main()->start_searching();
 }
+
+
+/// ThreadPool::stats_json() returns the counters of the last search, for each
+/// thread and in total, as a single line of JSON. The search statistics are
+/// there only in builds with stats=yes, as told by the "enabled" field. The
+/// tablebase latency histogram covers all the probes since the tables were loaded.
+
+std::string ThreadPool::stats_json() const {
+
+  static const char* Names[] = { "tt_cutoffs", "null_prunes", "lmr_researches",
+                                 "qsearch_nodes", "eval_calls", "lazy_evals" };
+
+  uint64_t total[STAT_NB] = {};
+  std::stringstream ss;
+
+#ifdef USE_STATS
+  ss << "{\"enabled\":true";
+#else
+  ss << "{\"enabled\":false";
+#endif
+
+  ss << ",\"threads\":[";
+
+  for (size_t i = 0; i < size(); ++i)
+  {
+      const Thread* th = at(i);
+
+      ss << (i ? "," : "") << "{\"id\":" << i
+         << ",\"nodes\":" << th->nodes.load(std::memory_order_relaxed)
+         << ",\"tb_hits\":" << th->tbHits.load(std::memory_order_relaxed)
+         << ",\"tt_probes\":" << th->ttProbes.load(std::memory_order_relaxed) * TTProbeSample
+         << ",\"eval_cache_probes\":" << th->evalCacheProbes.load(std::memory_order_relaxed)
+         << ",\"eval_cache_hits\":" << th->evalCacheHits.load(std::memory_order_relaxed)
+         << ",\"depth\":" << th->completedDepth / ONE_PLY;
+
+#ifdef USE_STATS
+      for (int c = 0; c < STAT_NB; ++c)
+      {
+          uint64_t v = th->stats[c].load(std::memory_order_relaxed);
+          ss << ",\"" << Names[c] << "\":" << v;
+          total[c] += v;
+      }
+#endif
+
+      ss << "}";
+  }
+
+  ss << "],\"total\":{\"nodes\":" << nodes_searched()
+     << ",\"tb_hits\":" << tb_hits()
+     << ",\"tt_probes\":" << tt_probes()
+     << ",\"eval_cache_probes\":" << eval_cache_probes()
+     << ",\"eval_cache_hits\":" << eval_cache_hits();
+
+#ifdef USE_STATS
+  for (int b = 0; b < Tablebases::LatencyBuckets; ++b)
+      ss << (b ? "," : ",\"tb_latency\":[")
+         << Tablebases::ProbeLatency[b].load(std::memory_order_relaxed);
+
+  ss << "]";
+
+  for (int c = 0; c < STAT_NB; ++c)
+      ss << ",\"" << Names[c] << "\":" << total[c];
+#else
+  (void)Names; (void)total;
+#endif
+
+  ss << "}}";
+
+  return ss.str();
+}
@@ -22,11 +22,13 @@
 #define THREAD_H_INCLUDED
 
 #include <atomic>
+#include <bitset>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
 #include <vector>
 
+#include "evaluate.h"
 #include "material.h"
 #include "movepick.h"
 #include "pawns.h"
@@ -34,6 +36,29 @@
 #include "search.h"
 #include "thread_win32.h"
 
+/// Search statistics counted per thread on the hot paths. They cost nothing
+/// unless the engine is built with stats=yes (see the Makefile), and are
+/// dumped as JSON by the "stats" command.
+enum StatsCounter {
+  STAT_TT_CUTOFF, STAT_NULL_PRUNE, STAT_LMR_RESEARCH,
+  STAT_QSEARCH_NODE, STAT_EVAL_CALL, STAT_LAZY_EVAL, STAT_NB
+};
+
+#ifdef USE_STATS
+#define STATS_COUNT(th, c) Thread::count((th)->stats[c])
+#else
+#define STATS_COUNT(th, c) ((void)0)
+#endif
+
+/// TT probes are counted for the "tt stats" report one in TTProbeSample only,
+/// and scaled back up when read, so that the default build pays no more than
+/// a plain increment per probe. Builds with stats=yes count all of them.
+#ifdef USE_STATS
+constexpr unsigned TTProbeSample = 1;
+#else
+constexpr unsigned TTProbeSample = 16;
+#endif
+
 
 /// Thread class keeps together all the thread-related stuff. We use
 /// per-thread pawn and material hash tables so that once we get a
@@ -42,32 +67,59 @@
 
 class Thread {
 
+  static constexpr uint64_t TurnNodes = 4096;
+
   Mutex mutex;
   ConditionVariable cv;
-  size_t idx;
+  size_t idx, poolSize; // Pool size the thread is bound for
+  int numaNode = -1;
   bool exit = false, searching = true; // Set before starting std::thread
+  bool historiesStale = true;
   std::thread stdThread;
 
 public:
-  explicit Thread(size_t);
+  Thread(size_t n, size_t count);
   virtual ~Thread();
   virtual void search();
   void clear();
+  void clear_histories();
   void idle_loop();
   void start_searching();
   void wait_for_search_finished();
+  void wait_turn();
+  void pass_turn(bool leave);
+  int numa_node() const { return numaNode; }
 
   Pawns::Table pawnsTable;
   Material::Table materialTable;
-  Endgames endgames;
+  Eval::Cache evalCache;
   size_t pvIdx, pvLast;
   int selDepth, nmpMinPly;
   Color nmpColor;
+  uint64_t turnEnd; // Node count at which to pass the turn, see pass_turn()
+  bool inTurns;
+
+  // Counters summed by ThreadPool::accumulate(). They are written by their own
+  // thread only, with count(), and are kept on cache lines of their own so that
+  // reading them from another thread does not disturb the search data.
+  char counterPadding1[64];
   std::atomic<uint64_t> nodes, tbHits;
+  std::atomic<uint64_t> ttProbes{}, ttHits{}, ttReplacements{}; // Sampled, see TTProbeSample
+  unsigned ttProbeTick = 0;
+  std::atomic<uint64_t> evalCacheProbes{}, evalCacheHits{};
+#ifdef USE_STATS
+  std::atomic<uint64_t> stats[STAT_NB]{};
+#endif
+  char counterPadding2[64];
+
+  static void count(std::atomic<uint64_t>& c) {
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
 
   Position rootPos;
   Search::RootMoves rootMoves;
   Depth rootDepth, completedDepth;
+  std::bitset<MAX_PLY> completedDepths; // Iterations completed in the current search
   CounterMoveHistory counterMoves;
   ButterflyHistory mainHistory;
   CapturePieceToHistory captureHistory;
@@ -84,10 +136,18 @@ struct MainThread : public Thread {
 
   void search() override;
   void check_time();
+  bool nodes_limit_reached(TimePoint tick);
+  Depth resume(const Position& pos, Search::RootMoves& seeds);
+  void warm_up(Move bookMove);
 
   double bestMoveChanges, previousTimeReduction;
   Value previousScore;
+  Thread* lastBestThread = nullptr; // Thread whose move was played by the last search
+  std::vector<Move> resumePv;       // PV, score and depth of the last search, see resume()
+  Value resumeScore;
+  Depth resumeDepth = DEPTH_ZERO;
   int callsCnt;
+  TimePoint lastNodesSample = 0;
 };
 
 
@@ -104,11 +164,30 @@ struct ThreadPool : public std::vector<Thread*> {
   MainThread* main()        const { return static_cast<MainThread*>(front()); }
   uint64_t nodes_searched() const { return accumulate(&Thread::nodes); }
   uint64_t tb_hits()        const { return accumulate(&Thread::tbHits); }
+  uint64_t tt_probes()      const { return accumulate(&Thread::ttProbes) * TTProbeSample; }
+  uint64_t tt_hits()        const { return accumulate(&Thread::ttHits) * TTProbeSample; }
+  uint64_t tt_replacements() const { return accumulate(&Thread::ttReplacements) * TTProbeSample; }
+  uint64_t eval_cache_probes() const { return accumulate(&Thread::evalCacheProbes); }
+  uint64_t eval_cache_hits()   const { return accumulate(&Thread::evalCacheHits); }
+
+  void wait_for_stop();
+  void notify_stop();
+  void stop_warmup();
+  std::string stats_json() const;
 
   std::atomic_bool stop, ponder, stopOnPonderhit;
+  std::atomic_bool warming;      // Main thread warms the TT up, see MainThread::warm_up()
+  bool deterministic;            // Threads search in turns, see Thread::pass_turn()
+  size_t turn;
+  Mutex turnMutex;
+  ConditionVariable turnCv;
+  Position rootPosition;         // Root of the current search, cloned by each thread
+  Search::RootMoves rootSeeds;   // Root moves of the current search, copied by each thread
 
 private:
   StateListPtr setupStates;
+  Mutex stopMutex;
+  ConditionVariable stopCv;
 
   uint64_t accumulate(std::atomic<uint64_t> Thread::* member) const {
 
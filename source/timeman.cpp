@@ -21,6 +21,9 @@
 #include <algorithm>
 #include <cfloat>
 #include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
 
 #include "search.h"
 #include "timeman.h"
@@ -104,6 +107,7 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
       limits.npmsec = npmsec;
   }
 
+  policy = Options["Time Policy"] == "Adaptive" ? ADAPTIVE : CLASSIC;
   startTime = limits.startTime;
   optimumTime = maximumTime = std::max(limits.time[us], minThinkingTime);
 
@@ -131,3 +135,103 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
   if (Options["Ponder"])
       optimumTime += optimumTime / 4;
 }
+
+
+/// stop_iterating() is called by the main thread after each completed iteration
+/// and tells whether to stop the search now rather than start a new iteration.
+/// It also sets timeReduction, which the next move reuses.
+
+bool TimeManagement::stop_iterating(const IterationStats& s, double& timeReduction) const {
+
+  const int F[] = { s.failedLow,
+                    s.bestValue - s.previousScore };
+
+  int improvingFactor = std::max(246, std::min(832, 306 + 119 * F[0] - 6 * F[1]));
+
+  // If the bestMove is stable over several iterations, reduce time accordingly
+  timeReduction = 1.0;
+  for (int i : {3, 4, 5})
+      if (s.lastBestMoveDepth * i < s.completedDepth)
+         timeReduction *= 1.25;
+
+  // Use part of the gained time from a previous stable move for the current move
+  double bestMoveInstability = 1.0 + s.bestMoveChanges;
+  bestMoveInstability *= std::pow(s.previousTimeReduction, 0.528) / timeReduction;
+
+  double limit = optimumTime * bestMoveInstability * improvingFactor / 581;
+  TimePoint elapsedTime = elapsed();
+
+  if (policy == CLASSIC)
+      return elapsedTime > limit;
+
+  // A score that swings between iterations asks for up to 50% more time
+  if (s.lastIterationValue != VALUE_NONE)
+      limit *= 1.0 + std::min(std::abs(s.bestValue - s.lastIterationValue), 100) / 200.0;
+
+  // A best move that takes nearly all the root nodes is a clear choice, one
+  // that takes half of them or less is still contested.
+  if (s.rootNodes)
+      limit *= 1.4 - 0.6 * double(s.bestMoveNodes) / s.rootNodes;
+
+  // Past half of the optimum, do not start an iteration that is unlikely to
+  // complete before the maximum time, going by the growth of the last ones.
+  if (s.previousIterationTime > 0 && elapsedTime > optimumTime / 2)
+  {
+      double growth = std::max(1.5, std::min(4.0, double(s.lastIterationTime) / s.previousIterationTime));
+
+      if (elapsedTime + s.lastIterationTime * growth > maximumTime)
+          return true;
+  }
+
+  return elapsedTime > limit;
+}
+
+
+/// log() appends the time figures of the move just played to the file of the
+/// "Time Log" option, so that time controls can be tuned offline. The file is
+/// in JSON lines if its name ends in ".json", and in CSV otherwise.
+
+void TimeManagement::log(const Search::LimitsType& limits, Color us, int ply, Depth depth, Value v) const {
+
+  std::string fname = Options["Time Log"];
+
+  if (fname.empty())
+      return;
+
+  bool json = fname.size() > 5 && fname.compare(fname.size() - 5, 5, ".json") == 0;
+  bool header = !json && !std::ifstream(fname);
+  std::ofstream file(fname, std::ios::out | std::ios::app);
+
+  if (!file)
+  {
+      sync_cout << "info string Could not write " << fname << sync_endl;
+      return;
+  }
+
+  TimePoint used = elapsed();
+  const char* policyName = policy == ADAPTIVE ? "adaptive" : "classic";
+
+  if (json)
+      file << "{\"ply\":" << ply
+           << ",\"policy\":\"" << policyName << "\""
+           << ",\"time\":" << limits.time[us]
+           << ",\"inc\":" << limits.inc[us]
+           << ",\"movestogo\":" << limits.movestogo
+           << ",\"optimum\":" << optimumTime
+           << ",\"maximum\":" << maximumTime
+           << ",\"used\":" << used
+           << ",\"remaining\":" << limits.time[us] - used
+           << ",\"depth\":" << depth / ONE_PLY
+           << ",\"score\":\"" << UCI::value(v) << "\""
+           << ",\"nodes\":" << Threads.nodes_searched() << "}\n";
+  else
+  {
+      if (header)
+          file << "ply,policy,time,inc,movestogo,optimum,maximum,used,remaining,depth,score,nodes\n";
+
+      file << ply << ',' << policyName << ','
+           << limits.time[us] << ',' << limits.inc[us] << ',' << limits.movestogo << ','
+           << optimumTime << ',' << maximumTime << ',' << used << ',' << limits.time[us] - used << ','
+           << depth / ONE_PLY << ',' << UCI::value(v) << ',' << Threads.nodes_searched() << '\n';
+  }
+}
@@ -25,12 +25,32 @@
 #include "search.h"
 #include "thread.h"
 
+/// IterationStats are the figures of the last completed iteration that the
+/// time policy looks at to decide whether a new iteration is worth starting.
+
+struct IterationStats {
+  Depth completedDepth, lastBestMoveDepth;
+  Value bestValue, previousScore, lastIterationValue;
+  bool failedLow;
+  double bestMoveChanges, previousTimeReduction;
+  uint64_t bestMoveNodes, rootNodes;
+  TimePoint lastIterationTime, previousIterationTime;
+};
+
 /// The TimeManagement class computes the optimal time to think depending on
 /// the maximum available time, the game move number and other parameters.
+/// The "Time Policy" option selects how the search uses it: "Classic" only
+/// looks at the best move changes and the score drop, "Adaptive" also at the
+/// score swing between iterations, the share of the root nodes taken by the
+/// best move and whether the next iteration can complete in time.
 
 class TimeManagement {
 public:
+  enum Policy { CLASSIC, ADAPTIVE };
+
   void init(Search::LimitsType& limits, Color us, int ply);
+  bool stop_iterating(const IterationStats& s, double& timeReduction) const;
+  void log(const Search::LimitsType& limits, Color us, int ply, Depth depth, Value v) const;
   TimePoint optimum() const { return optimumTime; }
   TimePoint maximum() const { return maximumTime; }
   TimePoint elapsed() const { return Search::Limits.npmsec ?
@@ -39,6 +59,7 @@ public:
   int64_t availableNodes; // When in 'nodes as time' mode
 
 private:
+  Policy policy;
   TimePoint startTime;
   TimePoint optimumTime;
   TimePoint maximumTime;
@@ -18,16 +18,17 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cstring>   // For std::memset
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include "uci.h"
 using std::string;
-#include <sstream>
+#include <atomic>
 #include <string>
-#include <sstream>
 #include <vector>
-#include <iterator>
+#include <thread>
 #include "position.h"
 #include "thread.h"
 #include "bitboard.h"
@@ -39,28 +40,16 @@ using std::string;
 #undef max
 #undef min
 
-#endif
+#else
 
-//https://stackoverflow.com/questions/236129/most-elegant-way-to-split-a-string
-template<typename Out>
-void split(const std::string &s, char delim, Out result) {
-	std::stringstream ss;
-	ss.str(s);
-	std::string item;
-	while (std::getline(ss, item, delim)) {
-		*(result++) = item;
-	}
-}
+#include <sys/mman.h>
 
-std::vector<std::string> split(const std::string &s, char delim) {
-	std::vector<std::string> elems;
-	split(s, delim, std::back_inserter(elems));
-	return elems;
-}
+#endif
 
 TranspositionTable TT; // Our global transposition table
-#ifdef _WIN32
+TranspositionTable::Cluster TranspositionTable::NoCluster;
 int use_large_pages = -1;
+#ifdef _WIN32
 int got_privileges = -1;
 #endif
 
@@ -115,6 +104,67 @@ void Try_Get_LockMemory_Privileges()
 }
 #endif
 
+#if defined(__linux__) && !defined(__ANDROID__)
+
+constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+/// alloc_large_pages() backs the table with 2 MiB pages. First we try an explicit
+/// hugetlbfs mapping, which only succeeds when the administrator has reserved
+/// enough huge pages (vm.nr_hugepages). Otherwise we map an anonymous region
+/// with room to align the table to a huge page boundary and ask the kernel to
+/// use transparent huge pages for it. The mapping is always zero filled.
+
+void* alloc_large_pages(size_t size, size_t& mappedSize) {
+
+  size_t hugeSize = (size + HugePageSize - 1) & ~(HugePageSize - 1);
+  void* mem = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+  mem = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (mem != MAP_FAILED)
+      return mappedSize = hugeSize, mem;
+#endif
+
+  mappedSize = hugeSize + HugePageSize;
+  mem = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+      return mappedSize = 0, nullptr;
+
+#ifdef MADV_HUGEPAGE
+  void* aligned = (void*)((uintptr_t(mem) + HugePageSize - 1) & ~(HugePageSize - 1));
+  madvise(aligned, hugeSize, MADV_HUGEPAGE);
+#endif
+
+  return mem;
+}
+
+#endif
+
+/// TranspositionTable::free_mem() releases the table memory with the function
+/// matching the way it was allocated.
+
+void TranspositionTable::free_mem() {
+
+  if (mem == NULL)
+      return;
+
+#ifdef _WIN32
+  if (large_pages_used)
+      VirtualFree(mem, 0, MEM_RELEASE);
+  else
+#elif defined(__linux__) && !defined(__ANDROID__)
+  if (large_pages_used)
+      munmap(mem, mappedSize);
+  else
+#endif
+      free(mem);
+
+  mem = NULL;
+  large_pages_used = false;
+}
+
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
 /// of clusters and each cluster consists of ClusterSize number of TTEntry.
@@ -129,75 +179,57 @@ void TranspositionTable::resize(size_t mbSize) {
 
   mbSize_last_used = mbSize;
 
+  if (deferred)
+      return;
+
+  wait_for_save();
+
 #ifdef _WIN32
   Try_Get_LockMemory_Privileges();
+#elif defined(__linux__) && !defined(__ANDROID__)
+  use_large_pages = bool(Options["Large Pages"]);
+#else
+  use_large_pages = 0;
 #endif
 
   size_t newClusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
 
-  if (newClusterCount == clusterCount)
-  {
-#ifdef _WIN32
-      if ((use_large_pages == 1) && (large_pages_used))      
-          return;
-      if ((use_large_pages == 0) && (large_pages_used == false))
-#endif
-          return;
-  }
+  if (   newClusterCount == clusterCount
+      && (use_large_pages == 1) == large_pages_used)
+      return;
 
   clusterCount = newClusterCount;
- 
-#ifdef _WIN32
-  if (use_large_pages < 1)
-#endif
-  {
-      if (mem != NULL)
-      {
-#ifdef _WIN32
-          if (large_pages_used)
-              VirtualFree(mem, 0, MEM_RELEASE);
-          else
-#endif
-              free(mem);
-      }
 
-      size_t memsize = clusterCount * sizeof(Cluster) + CacheLineSize - 1;
-      mem = calloc(memsize, 1);
-#ifdef _WIN32
-      large_pages_used = false;
-#endif
-  }
-#ifdef _WIN32
-  else
-  {
-      if (mem != NULL)
-      {
-          if (large_pages_used)
-              VirtualFree(mem, 0, MEM_RELEASE);
-          else
-              free(mem);
-      }
+  free_mem();
+
+  size_t memsize = clusterCount * sizeof(Cluster);
+  size_t alignment = CacheLineSize;
 
-      size_t memsize = clusterCount * sizeof(Cluster);
+  if (use_large_pages == 1)
+  {
+#ifdef _WIN32
       mem = VirtualAlloc(NULL, memsize, MEM_LARGE_PAGES | MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#elif defined(__linux__) && !defined(__ANDROID__)
+      mem = alloc_large_pages(memsize, mappedSize);
+      alignment = HugePageSize;
+#endif
       if (mem == NULL)
       {
           std::cerr << "Failed to allocate " << mbSize
               << "MB Large Page Memory for transposition table, switching to default" << std::endl;
 
           use_large_pages = 0;
-          memsize = clusterCount * sizeof(Cluster) + CacheLineSize - 1;
-          mem = calloc(memsize, 1);
-          large_pages_used = false;
+          alignment = CacheLineSize;
       }
       else
       {
           sync_cout << "info string LargePages " << (memsize >> 20) << " MiB" << sync_endl;
           large_pages_used = true;
       }
-        
   }
-#endif
+
+  if (mem == NULL)
+      mem = calloc(memsize + CacheLineSize - 1, 1);
 
   if (!mem)
   {
@@ -206,49 +238,339 @@ void TranspositionTable::resize(size_t mbSize) {
       exit(EXIT_FAILURE);
   }
 
-  table = (Cluster*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+  table = (Cluster*)((uintptr_t(mem) + alignment - 1) & ~(alignment - 1));
+
+  clear();
 }
 
 
 /// TranspositionTable::clear() overwrites the entire transposition table
 /// with zeros. It is called whenever the table is resized, or when the
 /// user asks the program to clear the table (from the UCI interface).
+/// The work is split among one helper per search thread. Each helper
+/// is bound like the search thread with the same index, so that on
+/// systems with a first-touch policy the pages get spread across the
+/// NUMA nodes in the same way as the threads that will use them.
 
 void TranspositionTable::clear() {
 
-  std::memset(table, 0, clusterCount * sizeof(Cluster));
+  if (deferred) // Will be zeroed when allocated
+      return;
+
+  wait_for_save();
+
+  const size_t threadCount = std::max(Threads.size(), size_t(1));
+  std::vector<std::thread> threads;
+
+  for (size_t idx = 0; idx < threadCount; ++idx)
+      threads.emplace_back([this, idx, threadCount]() {
+
+          // Same binding as the search threads, see Thread::idle_loop()
+          Numa::bindThisThread(idx, threadCount);
+
+          // Each thread zeroes its own slice of the table
+          const size_t stride = clusterCount / threadCount,
+                       start  = stride * idx,
+                       len    = idx != threadCount - 1 ? stride
+                                                       : clusterCount - start;
+
+          std::memset(&table[start], 0, len * sizeof(Cluster));
+      });
+
+  for (std::thread& th : threads)
+      th.join();
+}
+
+/// TranspositionTable::allocate() does the allocation deferred with defer(), so
+/// that the startup does not wait for it. It is called before the first use of
+/// the table, and does nothing once the table has been allocated.
+
+void TranspositionTable::allocate() {
+
+  if (deferred)
+  {
+      deferred = false;
+      resize(0); // Size recorded by the last call to resize()
+  }
 }
 
 void TranspositionTable::set_hash_file_name(const std::string& fname) { hashfilename = fname; }
 
+namespace {
+
+/// A hash file starts with a HashFileHeader followed by one record for each
+/// non-empty entry of the table, in cluster order. A record is the index of
+/// the cluster the entry was found in, followed by the raw TTEntry bytes. In
+/// compressed files the cluster index is replaced by the distance from the
+/// previous record's cluster, stored as a variable length integer (7 bits per
+/// byte, high bit set on all but the last byte). Because records are sorted
+/// these distances are small, so most of them take a single byte.
+
+constexpr char HashFileMagic[8] = { 'S', 'u', 'g', 'a', 'R', 'T', 'T', '\0' };
+constexpr uint32_t HashFileVersion = 1;
+constexpr uint32_t HashFileCompressed = 1;
+
+struct HashFileHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t clusterCount;
+  uint64_t entryCount;
+  uint8_t  generation;
+  uint8_t  entrySize;
+  uint8_t  clusterSize;
+  uint8_t  padding[5];
+};
+
+static_assert(sizeof(HashFileHeader) == 40, "HashFileHeader size incorrect");
+
+void write_varint(std::vector<char>& buf, uint64_t v) {
+
+  while (v >= 0x80)
+      buf.push_back(char((v & 0x7F) | 0x80)), v >>= 7;
+
+  buf.push_back(char(v));
+}
+
+bool read_varint(std::istream& is, uint64_t& v) {
+
+  v = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+      int c = is.get();
+      if (c == EOF)
+          return false;
+
+      v |= uint64_t(c & 0x7F) << shift;
+      if (!(c & 0x80))
+          return true;
+  }
+  return false;
+}
+
+/// middle_key() returns the middle of the range of 32 bit keys that first_entry()
+/// maps to cluster idx of a table with n clusters, that is (2 * idx + 1) * 2^31 / n.
+/// Done by long division, because the product overflows 64 bits for files of
+/// 2^32 clusters or more.
+
+Key middle_key(uint64_t idx, uint64_t n) {
+
+  uint64_t num = (idx << 1) + 1, key = num / n, rem = num % n;
+
+  for (int i = 0; i < 31; ++i)
+  {
+      rem <<= 1, key <<= 1;
+
+      if (rem >= n)
+          rem -= n, key |= 1;
+  }
+
+  return key;
+}
+
+} // namespace
+
+
+/// TranspositionTable::save() writes the non-empty entries of the table to
+/// the hash file. The writing is done by a background thread, so the call
+/// returns immediately; completion is reported with an "info string" line.
+
 bool TranspositionTable::save() {
-	std::ofstream b_stream(hashfilename,
-		std::fstream::out | std::fstream::binary);
-	if (b_stream)
-	{
-		//b_stream.write(reinterpret_cast<char const *>(table), clusterCount * sizeof(Cluster));
-		for (unsigned long long i = 0; i < clusterCount * sizeof(Cluster); i += (1 << 30)) { //1GB
-#ifndef __min
-        #define __min(a,b) (((a) < (b)) ? (a) : (b))
-#endif
-		    unsigned long long j = __min((1 << 30), (clusterCount * sizeof(Cluster)) - i);
-			b_stream.write(reinterpret_cast<char const *>(table) + i, j);
-		}
-		return (b_stream.good());
-	}
-	return false;
+
+  allocate();
+  wait_for_save();
+
+  saveThread = std::thread(&TranspositionTable::write_hash_file, this,
+                           hashfilename, bool(Options["HashFileCompress"]));
+  return true;
 }
 
+
+/// TranspositionTable::wait_for_save() blocks until a pending save, if any,
+/// has finished. Must be called before the table memory is touched by
+/// anything else than the search.
+
+void TranspositionTable::wait_for_save() {
+
+  if (saveThread.joinable())
+      saveThread.join();
+}
+
+
+/// TranspositionTable::write_hash_file() is the body of the save thread. The
+/// records are collected in a buffer that is flushed to disk every few MiB.
+
+void TranspositionTable::write_hash_file(std::string fname, bool compress) {
+
+  std::ofstream file(fname, std::ios::out | std::ios::binary);
+
+  if (!file)
+  {
+      sync_cout << "info string Could not open " << fname << sync_endl;
+      return;
+  }
+
+  HashFileHeader h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, HashFileMagic, sizeof(h.magic));
+  h.version      = HashFileVersion;
+  h.flags        = compress ? HashFileCompressed : 0;
+  h.clusterCount = clusterCount;
+  h.generation   = generation8;
+  h.entrySize    = uint8_t(sizeof(TTEntry));
+  h.clusterSize  = uint8_t(ClusterSize);
+
+  // Entry count is known only at the end, so rewrite the header then
+  file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+  constexpr size_t FlushSize = 4 * 1024 * 1024;
+  std::vector<char> buf;
+  buf.reserve(FlushSize + 64);
+  uint64_t lastIdx = 0;
+
+  for (uint64_t i = 0; i < clusterCount && file; ++i)
+      for (size_t j = 0; j < ClusterSize; ++j)
+      {
+          const TTEntry e = table[i].entry[j]; // Local copy, search may be running
+
+          if (!e.key)
+              continue;
+
+          if (compress)
+              write_varint(buf, i - lastIdx);
+          else
+          {
+              uint32_t idx32 = uint32_t(i);
+              buf.insert(buf.end(), (const char*)&idx32, (const char*)&idx32 + sizeof(idx32));
+          }
+
+          buf.insert(buf.end(), (const char*)&e, (const char*)&e + sizeof(e));
+          lastIdx = i;
+          h.entryCount++;
+
+          if (buf.size() >= FlushSize)
+              file.write(buf.data(), buf.size()), buf.clear();
+      }
+
+  file.write(buf.data(), buf.size());
+  file.seekp(0);
+  file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+  if (file.good())
+      sync_cout << "info string Hash saved: " << h.entryCount << " entries to " << fname << sync_endl;
+  else
+      sync_cout << "info string Could not write " << fname << sync_endl;
+}
+
+
+/// TranspositionTable::store_entry() inserts an entry read from a hash file
+/// with fileClusters clusters, where it was stored in cluster idx. With the
+/// 16 bit key only the upper bits of the key are kept in the entry, but idx
+/// tells which range of lower 32 bits the position key had, so we take the
+/// middle of that range to find the cluster in our table. If the table has the
+/// same size as the file this gives back the original cluster, otherwise the
+/// entry lands in the cluster covering most of the range. With the full key
+/// the cluster is simply recomputed. When the cluster is full, the entry with
+/// the lowest depth is replaced if it is shallower than the new one.
+
+void TranspositionTable::store_entry(uint64_t idx, uint64_t fileClusters, const TTEntry& e) {
+
+  Key lowKey = sizeof(e.key) == sizeof(Key) ? Key(e.key)
+                                            : middle_key(idx, fileClusters);
+  TTEntry* tte = first_entry(lowKey);
+  TTEntry* replace = tte;
+
+  for (size_t i = 0; i < ClusterSize; ++i)
+  {
+      if (!tte[i].key || tte[i].key == e.key)
+      {
+          replace = &tte[i];
+          break;
+      }
+
+      if (tte[i].depth8 < replace->depth8)
+          replace = &tte[i];
+  }
+
+  if (!replace->key || replace->key == e.key || replace->depth8 < e.depth8)
+      *replace = e;
+}
+
+
+/// TranspositionTable::load() reads the hash file into the current table,
+/// which keeps its size. Files in the old format, a raw dump of the cluster
+/// array, are still accepted; in that case the table is resized to the file
+/// size as before.
+
 void TranspositionTable::load() {
-	//file size: https://stackoverflow.com/questions/2409504/using-c-filestreams-fstream-how-can-you-determine-the-size-of-a-file
-	std::ifstream file;
-	file.open(hashfilename, std::ios::in | std::ios::binary);
-	file.ignore(std::numeric_limits<std::streamsize>::max());
-	std::streamsize size = file.gcount();
-	file.clear();   //  Since ignore will have set eof.
-	resize(size_t(size / 1024 / 1024));
-	file.seekg(0, std::ios::beg);
-	file.read(reinterpret_cast<char *>(table), clusterCount * sizeof(Cluster));
+
+  allocate();
+  wait_for_save();
+
+  std::ifstream file(hashfilename, std::ios::in | std::ios::binary);
+
+  if (!file)
+  {
+      sync_cout << "info string Could not open " << hashfilename << sync_endl;
+      return;
+  }
+
+  HashFileHeader h;
+  file.read(reinterpret_cast<char*>(&h), sizeof(h));
+
+  if (!file || std::memcmp(h.magic, HashFileMagic, sizeof(h.magic)))
+  {
+      //file size: https://stackoverflow.com/questions/2409504/using-c-filestreams-fstream-how-can-you-determine-the-size-of-a-file
+      file.clear();
+      file.seekg(0, std::ios::beg);
+      file.ignore(std::numeric_limits<std::streamsize>::max());
+      std::streamsize size = file.gcount();
+      file.clear();   //  Since ignore will have set eof.
+      resize(size_t(size / 1024 / 1024));
+      file.seekg(0, std::ios::beg);
+      file.read(reinterpret_cast<char *>(table), clusterCount * sizeof(Cluster));
+      return;
+  }
+
+  if (   h.version != HashFileVersion
+      || h.entrySize != sizeof(TTEntry)
+      || h.clusterCount == 0
+      || h.clusterCount > (uint64_t(1) << 32))
+  {
+      sync_cout << "info string Unsupported hash file " << hashfilename << sync_endl;
+      return;
+  }
+
+  clear();
+  generation8 = h.generation;
+
+  uint64_t idx = 0, n = 0;
+  TTEntry e;
+
+  for ( ; n < h.entryCount; ++n)
+  {
+      if (h.flags & HashFileCompressed)
+      {
+          uint64_t delta;
+          if (!read_varint(file, delta))
+              break;
+          idx += delta;
+      }
+      else
+      {
+          uint32_t idx32;
+          if (!file.read(reinterpret_cast<char*>(&idx32), sizeof(idx32)))
+              break;
+          idx = idx32;
+      }
+
+      if (!file.read(reinterpret_cast<char*>(&e), sizeof(e)) || idx >= h.clusterCount)
+          break;
+
+      store_entry(idx, h.clusterCount, e);
+  }
+
+  sync_cout << "info string Hash loaded: " << n << " entries from " << hashfilename << sync_endl;
 }
 
 enum { SAN_MOVE_NORMAL, SAN_PAWN_CAPTURE };
@@ -308,9 +630,12 @@ Move san_to_move(Position& pos, std::string& str)
 	if (idx != std::string::npos) {
 		uci.erase(idx); // erase to end of the string
 	}
+	if (uci.empty()) {
+		return MOVE_NONE; // invalid
+	}
 	idx = uci.find_first_of("=");
 	if (idx != std::string::npos) {
-		char promo = uci.at(idx);
+		char promo = idx + 1 < uci.size() ? uci.at(idx + 1) : ' ';
 		switch (promo) {
 		case 'Q': promotion = QUEEN; break;
 		case 'R': promotion = ROOK; break;
@@ -378,8 +703,14 @@ Move san_to_move(Position& pos, std::string& str)
 	}
 
 	// normal move or promotion
+	if (uci.size() < 2) {
+		return MOVE_NONE; // invalid
+	}
 	int torank = uci.at(uci.size() - 1) - '1';
 	int tofile = uci.at(uci.size() - 2) - 'a';
+	if (torank < 0 || torank > 7 || tofile < 0 || tofile > 7) {
+		return MOVE_NONE; // invalid
+	}
 	int disambig_r = -1;
 	int disambig_f = -1;
 	if (piecetype != PAWN && piecetype != KING && uci.size() > 3) {
@@ -494,66 +825,147 @@ Value uci_to_score(std::string &str)
 	return v;
 }
 
+namespace {
+
+/// EpdRecord keeps what we need from one EPD line: the FEN part and the
+/// values of the "acd" (depth), "bm" (best move, SAN) and "ce" (score) opcodes.
+
+struct EpdRecord {
+  std::string fen, bm, ce;
+  int depth = 0;
+};
+
+std::string trim(const std::string& s) {
+
+  size_t first = s.find_first_not_of(" \t\r\n");
+  size_t last  = s.find_last_not_of(" \t\r\n");
+  return first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+}
+
+/// parse_epd() splits a line of the form "<fen> acd 20; bm Nf3; ce 35;" into
+/// its fields. The first operation follows the FEN without a separator, so the
+/// FEN is whatever comes before the first "acd" opcode.
+
+bool parse_epd(const std::string& line, EpdRecord& r) {
+
+  size_t acd = line.find("acd ");
+  if (acd == std::string::npos || acd == 0)
+      return false;
+
+  r.fen = trim(line.substr(0, acd));
+  r.bm.clear();
+  r.ce.clear();
+  r.depth = atoi(line.c_str() + acd + 4);
+
+  size_t start = line.find(';', acd);
+
+  while (start != std::string::npos)
+  {
+      size_t end = line.find(';', start + 1);
+      std::string op = trim(line.substr(start + 1, end == std::string::npos ? std::string::npos
+                                                                              : end - start - 1));
+      if (op.compare(0, 3, "bm ") == 0 && r.bm.empty())
+          r.bm = trim(op.substr(3));
+
+      else if (op.compare(0, 3, "ce ") == 0 && r.ce.empty())
+          r.ce = trim(op.substr(3));
+
+      start = end;
+  }
+
+  return !r.fen.empty() && r.depth > 0;
+}
+
+} // namespace
+
+
+/// TranspositionTable::load_epd_to_hash() imports an EPD file of analysed
+/// positions into the table. Lines are read in batches, and each batch is split
+/// among one worker per search thread. Workers reuse their own Position and
+/// StateInfo for every line and store the results directly, keeping a deeper
+/// entry already in the table for the same position. A single summary line
+/// is printed at the end.
+
 void TranspositionTable::load_epd_to_hash() {
-	std::string line;
-	std::ifstream myfile(hashfilename);
-	Position pos;
-	Move bm;
-	int ce;
-	int depth;
-	generation8 = 4; //for storing the positions
-
-	if (myfile.is_open())
-	{
-		while (getline(myfile, line))
-		{
-			std::vector<std::string> x = split(line, ';');
-
-			//extract and set position
-			std::size_t i = x[0].find("acd"); //depth searched. Is after the fen string
-			StateListPtr states(new std::deque<StateInfo>(1));
-			sync_cout << x[0].substr(0, i) << sync_endl;
-			pos.set(x[0].substr(0, i), Options["UCI_Chess960"], &states->back(), Threads.main());
-			
-			//depth
-			depth = std::stoi(x[0].substr(i + 4));
-			sync_cout << depth << sync_endl;
-
-			bm = MOVE_NONE;
-			ce = -1000000;
-
-			for (std::vector<int>::size_type j = 1; j <= x.size(); j++) {
-				if (bm == MOVE_NONE) {
-					i = x[j].find("bm ");
-					if (i == 1) {
-						sync_cout << x[j].substr(i + 3) << sync_endl;
-						std::string stri = x[j].substr(i + 3);
-						bm = san_to_move(pos, stri);
-						if (bm != MOVE_NONE)
-							sync_cout << "move ok" << sync_endl;
-						continue;
-					}
-				}
-				if (ce == -1000000) {
-					i = x[j].find("ce ");
-					if (i == 1) {
-						std::string stri = x[j].substr(i + 3);
-						ce = uci_to_score(stri);
-						sync_cout << "ce " << ce << sync_endl;
-						continue;
-					}
-				}
-			}
 
-			TTEntry* tte;
-			bool ttHit;
-			tte = TT.probe(pos.key(), ttHit);
+  allocate();
 
-			tte->save(pos.key(), (Value)ce, BOUND_EXACT, (Depth)depth,
-				bm, VALUE_NONE, TT.generation());
-		}
-		myfile.close();
-	}
+  std::ifstream file(hashfilename);
+
+  if (!file.is_open())
+  {
+      sync_cout << "info string Could not open " << hashfilename << sync_endl;
+      return;
+  }
+
+  wait_for_save();
+  generation8 = 4; //for storing the positions
+
+  constexpr size_t BatchSize = 1 << 16;
+  const size_t workerCount = std::max(Threads.size(), size_t(1));
+  const bool chess960 = Options["UCI_Chess960"];
+  std::vector<std::string> lines(BatchSize);
+  std::vector<std::thread> workers;
+  std::atomic<uint64_t> imported(0), skipped(0);
+  TimePoint elapsed = now();
+
+  while (file)
+  {
+      size_t cnt = 0;
+      while (cnt < BatchSize && std::getline(file, lines[cnt]))
+          ++cnt;
+
+      for (size_t w = 0; w < workerCount; ++w)
+          workers.emplace_back([&, w]() {
+
+              Position pos;
+              StateInfo st;
+              EpdRecord r;
+              uint64_t ok = 0, bad = 0;
+
+              for (size_t i = w; i < cnt; i += workerCount)
+              {
+                  if (!parse_epd(lines[i], r))
+                  {
+                      bad++;
+                      continue;
+                  }
+
+                  pos.set(r.fen, chess960, &st, Threads.empty() ? nullptr : Threads[w % Threads.size()]);
+
+                  Move bm = r.bm.empty() ? MOVE_NONE : san_to_move(pos, r.bm);
+                  Value ce = r.ce.empty() ? VALUE_NONE : uci_to_score(r.ce);
+                  Depth d = std::min(r.depth, int(DEPTH_MAX / ONE_PLY) - 1) * ONE_PLY;
+
+                  if (bm == MOVE_NONE && ce == VALUE_NONE)
+                  {
+                      bad++;
+                      continue;
+                  }
+
+                  bool ttHit;
+                  TTEntry* tte = probe(pos.key(), ttHit);
+
+                  if (!ttHit || tte->depth() <= d)
+                      tte->save(pos.key(), ce, ce == VALUE_NONE ? BOUND_NONE : BOUND_EXACT,
+                                d, bm, VALUE_NONE, generation8);
+                  ok++;
+              }
+
+              imported += ok;
+              skipped += bad;
+          });
+
+      for (std::thread& th : workers)
+          th.join();
+
+      workers.clear();
+  }
+
+  elapsed = now() - elapsed + 1;
+
+  sync_cout << "info string EPD imported: " << imported << " positions, "
+            << skipped << " skipped, in " << elapsed << " ms" << sync_endl;
 }
 
 /// TranspositionTable::probe() looks up the current position in the transposition
@@ -566,15 +978,15 @@ void TranspositionTable::load_epd_to_hash() {
 TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 
   TTEntry* const tte = first_entry(key);
-  const uint16_t key16 = key >> 48;  // Use the high 16 bits as key inside the cluster
+  const auto keyN = TTEntry::key_of(key);  // Use the high bits as key inside the cluster
 
   for (size_t i = 0; i < ClusterSize; ++i)
-      if (!tte[i].key16 || tte[i].key16 == key16)
+      if (!tte[i].key || tte[i].key == keyN)
       {
-          if ((tte[i].genBound8 & 0xFC) != generation8 && tte[i].key16)
+          if ((tte[i].genBound8 & 0xFC) != generation8 && tte[i].key)
               tte[i].genBound8 += 4; // Refresh
 
-          return found = (bool)tte[i].key16, &tte[i];
+          return found = (bool)tte[i].key, &tte[i];
       }
 
   // Find an entry to be replaced according to the replacement strategy
@@ -592,19 +1004,100 @@ TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 }
 
 
+/// TranspositionTable::sample_cluster() returns the i-th of a set of samples
+/// spread over the whole table. Looking at the first clusters only is skewed
+/// after a hash file load or an EPD import, which fill the table from the
+/// positions they contain, so the samples are scattered by a multiplicative
+/// hash of their number, the same way first_entry() maps the keys.
+
+const TranspositionTable::Cluster& TranspositionTable::sample_cluster(size_t i, size_t samples) const {
+
+  if (samples >= clusterCount)
+      return table[i % clusterCount];
+
+  return table[(uint32_t(i * 0x9E3779B97F4A7C15ULL >> 32) * uint64_t(clusterCount)) >> 32];
+}
+
+
 /// TranspositionTable::hashfull() returns an approximation of the hashtable
 /// occupation during a search. The hash is x permill full, as per UCI protocol.
 
 int TranspositionTable::hashfull() const {
 
+  constexpr size_t Samples = (1000 + ClusterSize - 1) / ClusterSize;
+
   int cnt = 0;
-  for (size_t i = 0; i < 1000 / ClusterSize; i++)
+  for (size_t i = 0; i < Samples; i++)
   {
-      const TTEntry* tte = &table[i].entry[0];
+      const TTEntry* tte = &sample_cluster(i, Samples).entry[0];
       for (size_t j = 0; j < ClusterSize; j++)
           if ((tte[j].genBound8 & 0xFC) == generation8)
               cnt++;
   }
-  return cnt;
+  return int(cnt * 1000 / (Samples * ClusterSize));
 }
 
+
+/// TranspositionTable::stats() returns a report, as UCI info strings, on a
+/// sample of the table: occupancy, age of the entries in generations, depth
+/// distribution, and the sampled probe counters of the threads for the last search.
+
+std::string TranspositionTable::stats() const {
+
+  constexpr size_t Samples = 16384;
+  constexpr int AgeBuckets = 8, DepthBuckets = 8;
+
+  uint64_t used = 0, total = 0;
+  uint64_t ages[AgeBuckets] = {}, depths[DepthBuckets] = {};
+
+  for (size_t i = 0; i < Samples; i++)
+  {
+      const TTEntry* tte = &sample_cluster(i, Samples).entry[0];
+      for (size_t j = 0; j < ClusterSize; j++, total++)
+      {
+          if (tte[j].empty())
+              continue;
+
+          int age = ((259 + generation8 - tte[j].genBound8) & 0xFC) / 4;
+          int d = tte[j].depth8;
+
+          used++;
+          ages[std::min(age, AgeBuckets - 1)]++;
+          depths[d <= 0 ? 0 : std::min((d + 3) / 4, DepthBuckets - 1)]++;
+      }
+  }
+
+  auto permill = [](uint64_t n, uint64_t d) { return d ? n * 1000 / d : 0; };
+
+  uint64_t probes = Threads.tt_probes(), hits = Threads.tt_hits();
+  std::stringstream ss;
+
+  ss << "info string tt clusters " << clusterCount
+     << " entries/cluster " << ClusterSize
+     << " entry " << sizeof(TTEntry) << " bytes"
+     << " generation " << (generation8 >> 2)
+     << "\ninfo string tt occupancy " << permill(used, total) << " permill"
+     << " current generation " << hashfull() << " permill"
+     << "\ninfo string tt age permill";
+
+  for (int i = 0; i < AgeBuckets; i++)
+      ss << " " << i << (i == AgeBuckets - 1 ? "+:" : ":") << permill(ages[i], used);
+
+  ss << "\ninfo string tt depth permill <1:" << permill(depths[0], used);
+
+  for (int i = 1; i < DepthBuckets; i++)
+  {
+      ss << " " << 4 * i - 3;
+      if (i < DepthBuckets - 1)
+          ss << "-" << 4 * i << ":";
+      else
+          ss << "+:";
+      ss << permill(depths[i], used);
+  }
+
+  ss << "\ninfo string tt probes " << probes
+     << " hits " << hits << " (" << permill(hits, probes) << " permill)"
+     << " replacements " << Threads.tt_replacements();
+
+  return ss.str();
+}
@@ -21,42 +21,52 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <string>
+#include <thread>
+
 #include "misc.h"
 #include "types.h"
 
-/// TTEntry struct is the 10 bytes transposition table entry, defined as below:
+/// TTEntryT struct is the transposition table entry, defined as below:
 ///
-/// key        16 bit
+/// key        16 or 64 bit, the high bits of the position key
 /// move       16 bit
 /// value      16 bit
 /// eval value 16 bit
 /// generation  6 bit
 /// bound type  2 bit
 /// depth       8 bit
+///
+/// The 16 bit key makes a 10 bytes entry, the 64 bit one a 16 bytes entry that
+/// never gives a false hit.
+
+template<typename KeyType>
+struct TTEntryT {
 
-struct TTEntry {
+  static KeyType key_of(Key k) { return KeyType(k >> (64 - 8 * sizeof(KeyType))); }
 
   Move  move()  const { return (Move )move16; }
   Value value() const { return (Value)value16; }
   Value eval()  const { return (Value)eval16; }
   Depth depth() const { return (Depth)(depth8 * int(ONE_PLY)); }
   Bound bound() const { return (Bound)(genBound8 & 0x3); }
+  bool  empty() const { return !key; }
 
   void save(Key k, Value v, Bound b, Depth d, Move m, Value ev, uint8_t g) {
 
     assert(d / ONE_PLY * ONE_PLY == d);
 
     // Preserve any existing move for the same position
-    if (m || (k >> 48) != key16)
+    if (m || key_of(k) != key)
         move16 = (uint16_t)m;
 
     // Don't overwrite more valuable entries
-    if (  (k >> 48) != key16
+    if (  key_of(k) != key
         || d / ONE_PLY > depth8 - 4
      /* || g != (genBound8 & 0xFC) // Matching non-zero keys are already refreshed by probe() */
         || b == BOUND_EXACT)
     {
-        key16     = (uint16_t)(k >> 48);
+        key       = key_of(k);
         value16   = (int16_t)v;
         eval16    = (int16_t)ev;
         genBound8 = (uint8_t)(g | b);
@@ -67,7 +77,7 @@ struct TTEntry {
 private:
   friend class TranspositionTable;
 
-  uint16_t key16;
+  KeyType  key;
   uint16_t move16;
   int16_t  value16;
   int16_t  eval16;
@@ -76,6 +86,37 @@ private:
 };
 
 
+/// TTCluster is a bucket of Size entries, padded so that its size divides the
+/// size of a cache line.
+
+template<typename Entry, size_t Size, size_t Padding>
+struct TTCluster {
+  Entry entry[Size];
+  char padding[Padding];
+};
+
+template<typename Entry, size_t Size>
+struct TTCluster<Entry, Size, 0> {
+  Entry entry[Size];
+};
+
+
+/// The cluster layout is selected at compile time (make ttbucket=32/64). The
+/// default one packs 3 entries with a 16 bit key in 32 bytes; TT_BUCKET_64
+/// packs 4 entries with the full key in a 64 bytes cache line, which halves
+/// the number of clusters for a given Hash but removes false hits.
+
+#ifdef TT_BUCKET_64
+typedef TTEntryT<uint64_t> TTEntry;
+constexpr size_t TTClusterSize = 4;
+constexpr size_t TTClusterPadding = 0;
+#else
+typedef TTEntryT<uint16_t> TTEntry;
+constexpr size_t TTClusterSize = 3;
+constexpr size_t TTClusterPadding = 2;
+#endif
+
+
 /// A TranspositionTable consists of a power of 2 number of clusters and each
 /// cluster consists of ClusterSize number of TTEntry. Each non-empty entry
 /// contains information of exactly one position. The size of a cluster should
@@ -86,28 +127,31 @@ private:
 class TranspositionTable {
 
   static constexpr size_t CacheLineSize = 64;
-  static constexpr size_t ClusterSize = 3;
+  static constexpr size_t ClusterSize = TTClusterSize;
 
-  struct Cluster {
-    TTEntry entry[ClusterSize];
-    char padding[2]; // Align to a divisor of the cache line size
-  };
+  typedef TTCluster<TTEntry, ClusterSize, TTClusterPadding> Cluster;
 
   static_assert(CacheLineSize % sizeof(Cluster) == 0, "Cluster size incorrect");
 
+  static Cluster NoCluster;
+
 public:
   TranspositionTable() { mbSize_last_used = 0;  mbSize_last_used = 0; }
- ~TranspositionTable() {}
+ ~TranspositionTable() { wait_for_save(); }
   void new_search() { generation8 += 4; } // Lower 2 bits are used by Bound
   void infinite_search() { generation8 = 4; }
   uint8_t generation() const { return generation8; }
   TTEntry* probe(const Key key, bool& found) const;
   int hashfull() const;
+  std::string stats() const;
   void resize(size_t mbSize);
   void clear();
+  void defer() { deferred = true; }
+  void allocate();
   void set_hash_file_name(const std::string& fname);
   bool save();
   void load();
+  void wait_for_save();
   void load_epd_to_hash();
   std::string hashfilename = "hash.hsh";
 
@@ -117,16 +161,21 @@ public:
   }
 
 private:
-  size_t  mbSize_last_used;
+  void free_mem();
+  const Cluster& sample_cluster(size_t i, size_t samples) const;
+  void write_hash_file(std::string fname, bool compress);
+  void store_entry(uint64_t idx, uint64_t fileClusters, const TTEntry& e);
 
-#ifdef _WIN32
+  size_t  mbSize_last_used;
+  bool deferred = false; // Resizes only record the size until allocate()
   bool large_pages_used;
-#endif
+  size_t mappedSize; // Length of the large pages mapping, used by munmap()
 
   size_t clusterCount;
-  Cluster* table;
+  Cluster* table = &NoCluster; // Until allocated, so that first_entry() is valid
   void* mem;
   uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
+  std::thread saveThread;
 };
 
 extern TranspositionTable TT;
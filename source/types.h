@@ -72,6 +72,10 @@
 #  include <xmmintrin.h> // Intel and Microsoft header for _mm_prefetch()
 #endif
 
+#if defined(USE_AVX2) || defined(USE_AVX512) || defined(USE_DISPATCH)
+#  include <immintrin.h> // Header for the AVX2 and AVX-512 intrinsics
+#endif
+
 #if defined(USE_PEXT)
 #  include <immintrin.h> // Header for _pext_u64() intrinsic
 #  define pext(b, m) _pext_u64(b, m)
@@ -79,16 +83,50 @@
 #  define pext(b, m) 0
 #endif
 
+/// With USE_DISPATCH (the x86-64-evaldispatch build) the instruction set
+/// extensions are detected at startup by Dispatch::init(), which then picks the
+/// evaluation compiled for popcnt and the AVX2 move scoring, whatever the flags
+/// of the rest of the program. Only these are dispatched: the slider attacks
+/// always use the magics there, because pext would need tables of another
+/// layout and so a test of the CPU at each lookup. The only AVX-512 kernel, the
+/// mobility count, is not worth a copy of the evaluation.
+
+#ifdef USE_PEXT
+constexpr bool HasPext = true;
+#else
+constexpr bool HasPext = false;
+#endif
+
+#ifdef USE_AVX512
+constexpr bool HasAvx512 = true;
+#else
+constexpr bool HasAvx512 = false;
+#endif
+
+#if defined(USE_DISPATCH)
+
+extern bool HasPopCnt, HasAvx2;
+
+#  define TARGET_POPCNT __attribute__((target("popcnt")))
+#  define TARGET_AVX2   __attribute__((target("avx2")))
+
+#else
+
 #ifdef USE_POPCNT
 constexpr bool HasPopCnt = true;
 #else
 constexpr bool HasPopCnt = false;
 #endif
 
-#ifdef USE_PEXT
-constexpr bool HasPext = true;
+#ifdef USE_AVX2
+constexpr bool HasAvx2 = true;
 #else
-constexpr bool HasPext = false;
+constexpr bool HasAvx2 = false;
+#endif
+
+#  define TARGET_POPCNT
+#  define TARGET_AVX2
+
 #endif
 
 #ifdef IS_64BIT
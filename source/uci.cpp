@@ -18,12 +18,17 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "evaluate.h"
+#include "learn.h"
 #include "movegen.h"
 #include "position.h"
 #include "search.h"
@@ -36,12 +41,50 @@
 using namespace std;
 
 extern vector<string> setup_bench(const Position&, istream&);
+extern void microbench(istream&);
+
+int64_t UCI::StartupTime;
 
 namespace {
 
   // FEN string of the initial position, normal chess
   const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
+  // The game set up by the last "position" command. GUIs send the whole game at
+  // each move, so when the new move list extends the last one, only the new moves
+  // are made, after the states of the last ones.
+  struct Game {
+    string fen;
+    bool chess960;
+    vector<string> moves;
+    Key key;             // Of the last position, unless changed since, e.g. by "flip"
+    StateListPtr states;
+  } LastGame;
+
+
+  // json_string() returns a string as a JSON string literal, with the quotes,
+  // backslashes and control characters escaped.
+
+  string json_string(const string& str) {
+
+    string s = "\"";
+
+    for (char c : str)
+        if (c == '"' || c == '\\')
+            s += string("\\") + c;
+
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", int(c));
+            s += buf;
+        }
+        else
+            s += c;
+
+    return s + "\"";
+  }
+
 
   // position() is called when engine receives the "position" UCI command.
   // The function sets up the position described in the given FEN string ("fen")
@@ -66,15 +109,41 @@ namespace {
     else
         return;
 
-    states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
-    pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+    vector<string> moves;
+    bool chess960 = Options["UCI_Chess960"];
+
+    while (is >> token)
+        moves.push_back(token);
+
+    size_t made = 0;
+
+    if (   LastGame.states
+        && LastGame.fen == fen
+        && LastGame.chess960 == chess960
+        && LastGame.key == pos.key()
+        && pos.this_thread() == Threads.main()
+        && LastGame.moves.size() <= moves.size()
+        && std::equal(LastGame.moves.begin(), LastGame.moves.end(), moves.begin()))
+        made = LastGame.moves.size();
+    else
+    {
+        LastGame.states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
+        LastGame.fen = fen;
+        LastGame.chess960 = chess960;
+        LastGame.moves.clear();
+        pos.set(fen, chess960, &LastGame.states->back(), Threads.main());
+    }
 
-    // Parse move list (if any)
-    while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
+    // Parse the rest of the move list (if any)
+    for ( ; made < moves.size() && (m = UCI::to_move(pos, moves[made])) != MOVE_NONE; ++made)
     {
-        states->emplace_back();
-        pos.do_move(m, states->back());
+        LastGame.states->emplace_back();
+        pos.do_move(m, LastGame.states->back());
+        LastGame.moves.push_back(moves[made]);
     }
+
+    LastGame.key = pos.key();
+    states = LastGame.states;
   }
 
 
@@ -172,11 +241,351 @@ namespace {
     dbg_print(); // Just before exiting
 
     cerr << "\n==========================="
+         << "\nStartup (ms)    : " << UCI::StartupTime
          << "\nTotal time (ms) : " << elapsed
          << "\nNodes searched  : " << nodes
          << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
   }
 
+
+  // bench_json() is called when engine receives the "benchjson" command. It
+  // takes the parameters of bench, except that the number of threads may be a
+  // comma separated list, for instance "benchjson 16 1,2,4 13". The bench runs
+  // once for each thread count, and the results are printed, after the output
+  // of the searches, as a JSON object on one line.
+
+  void bench_json(Position& pos, istream& args, StateListPtr& states) {
+
+    string token, rest, threads, fen;
+    string ttSize     = (args >> token) ? token : "16";
+    string threadList = (args >> token) ? token : "1";
+    getline(args, rest);
+
+    stringstream json, ts(threadList);
+    double baseNps = 0;
+    bool firstRun = true;
+
+    json << "{\"startup_ms\":" << UCI::StartupTime << ",\"runs\":[";
+
+    while (getline(ts, threads, ','))
+    {
+        istringstream is(ttSize + " " + threads + rest);
+        vector<string> list = setup_bench(pos, is);
+        uint64_t nodes = 0, probes = 0, hits = 0;
+        stringstream positions;
+        bool firstPos = true;
+
+        TimePoint elapsed = now();
+
+        for (const auto& cmd : list)
+        {
+            istringstream cs(cmd);
+            cs >> skipws >> token;
+
+            if (token == "go")
+            {
+                TimePoint time = now();
+                go(pos, cs, states);
+                Threads.main()->wait_for_search_finished();
+                time = now() - time + 1;
+
+                uint64_t n = Threads.nodes_searched();
+                uint64_t p = Threads.tt_probes(), h = Threads.tt_hits();
+                nodes += n, probes += p, hits += h;
+
+                positions << (firstPos ? "" : ",")
+                          << "{\"fen\":"         << json_string(fen)
+                          << ",\"depth\":"       << Threads.main()->completedDepth / ONE_PLY
+                          << ",\"time_ms\":"     << time
+                          << ",\"nodes\":"       << n
+                          << ",\"nps\":"         << 1000 * n / time
+                          << ",\"tt_hit_rate\":" << (p ? double(h) / p : 0.0) << "}";
+                firstPos = false;
+            }
+            else if (token == "setoption")  setoption(cs);
+            else if (token == "position")   position(pos, cs, states), fen = pos.fen();
+            else if (token == "ucinewgame") Search::clear();
+        }
+
+        elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+
+        uint64_t nps = 1000 * nodes / elapsed;
+        if (firstRun)
+            baseNps = double(std::max(nps, uint64_t(1)));
+
+        json << (firstRun ? "" : ",")
+             << "{\"threads\":"      << threads
+             << ",\"time_ms\":"      << elapsed
+             << ",\"nodes\":"        << nodes
+             << ",\"nps\":"          << nps
+             << ",\"nps_scaling\":"  << nps / baseNps
+             << ",\"tt_hit_rate\":"  << (probes ? double(hits) / probes : 0.0)
+             << ",\"positions\":["   << positions.str() << "]}";
+        firstRun = false;
+    }
+
+    json << "]}";
+    sync_cout << json.str() << sync_endl;
+  }
+
+
+  // run_job() sets up the position given by the arguments of a "position"
+  // command, searches it with the given limits, "depth 13" if none, and waits
+  // for the search to finish. It returns the thread whose best move was played.
+  // A muted job prints nothing, the caller reports the result.
+
+  const Thread* run_job(Position& pos, const string& spec, const string& limits,
+                        StateListPtr& states, bool muted) {
+
+    istringstream posArgs(spec);
+    istringstream goArgs(limits.empty() ? string("depth 13") : limits);
+
+    Output::Muted = muted;
+    position(pos, posArgs, states);
+    go(pos, goArgs, states);
+    Threads.main()->wait_for_search_finished();
+    Output::Muted = false;
+
+    return Threads.main()->lastBestThread;
+  }
+
+
+  // job_score() returns the score of the best move found by run_job(). When the
+  // position has no legal moves, the root move is MOVE_NONE and was never scored,
+  // so the score is mate or draw, as MainThread::search() reports it.
+
+  Value job_score(const Thread* best, const Position& pos) {
+
+    if (best->rootMoves.empty() || best->rootMoves[0].pv[0] == MOVE_NONE)
+        return pos.checkers() ? -VALUE_MATE : VALUE_DRAW;
+
+    const Search::RootMove& rm = best->rootMoves[0];
+    return rm.score != -VALUE_INFINITE ? rm.score : rm.previousScore;
+  }
+
+
+  // batch() is called when engine receives the "batch" command, followed by the
+  // name of a file with one job per line and by the default limits of the jobs,
+  // for instance "batch games.epd depth 20". A job is a FEN string, or the
+  // arguments of a "position" command, optionally followed by "go" and its own
+  // limits. The jobs run one after the other on the whole thread pool, with a
+  // shared hash table, book and tablebases, and their results are returned
+  // together once the batch is done.
+
+  void batch(Position& pos, istringstream& is, StateListPtr& states) {
+
+    string fileName, line, token, defaultGo;
+
+    is >> fileName;
+    while (is >> token)
+        defaultGo += token + " ";
+
+    ifstream file(fileName);
+
+    if (!file.is_open())
+    {
+        sync_cout << "info string Unable to open file " << fileName << sync_endl;
+        return;
+    }
+
+    stringstream results;
+    size_t jobs = 0;
+    uint64_t nodes = 0;
+    TimePoint elapsed = now();
+
+    while (getline(file, line))
+    {
+        size_t goPos = line.find(" go ");
+        string spec = line.substr(0, goPos);
+        string limits = goPos == string::npos ? defaultGo : line.substr(goPos + 4);
+
+        istringstream ss(spec);
+        if (!(ss >> token))
+            continue;
+
+        const Thread* best = run_job(pos, token == "startpos" || token == "fen" ? spec : "fen " + spec,
+                                     limits, states, false);
+        const Search::RootMove& rm = best->rootMoves[0];
+
+        results << "result " << ++jobs
+                << " bestmove " << UCI::move(rm.pv[0], pos.is_chess960())
+                << " score "    << UCI::value(job_score(best, pos))
+                << " depth "    << best->completedDepth / ONE_PLY
+                << " nodes "    << Threads.nodes_searched()
+                << " fen "      << pos.fen() << "\n";
+
+        nodes += Threads.nodes_searched();
+    }
+
+    elapsed = now() - elapsed + 1;
+
+    sync_cout << results.str()
+              << "info string batch " << jobs << " jobs"
+              << " nodes " << nodes
+              << " time " << elapsed
+              << " nps " << 1000 * nodes / elapsed << sync_endl;
+  }
+
+
+  // epd_op() returns the operand of an EPD operation, without its quotes, or
+  // an empty string if there is no such operation in 'ops'.
+
+  string epd_op(const string& ops, const string& opcode) {
+
+    size_t start = 0;
+
+    while ((start = ops.find(opcode + " ", start)) != string::npos)
+    {
+        if (start == 0 || ops[start - 1] == ' ' || ops[start - 1] == ';')
+        {
+            size_t end = ops.find(';', start);
+            string operand = ops.substr(start + opcode.size() + 1,
+                                        end == string::npos ? string::npos : end - start - opcode.size() - 1);
+            operand.erase(std::remove(operand.begin(), operand.end(), '"'), operand.end());
+            return operand;
+        }
+        start += opcode.size();
+    }
+
+    return string();
+  }
+
+
+  // analyse() is called when engine receives the "analyse" command, followed by
+  // the input file, the output file, an optional "keephash" and the limits of
+  // each search, for instance "analyse suite.epd results.json depth 20". Either
+  // file may be "-" for the standard input or output. The input has one FEN or
+  // EPD per line, and from the standard input it ends at EOF or at a line "end".
+  // The positions are searched one after the other without UCI output, and a
+  // line of JSON with the results of each one is written as soon as it is done.
+  // Unless "keephash" is given, the search state is reset between positions as
+  // for a new game; keeping it helps when the positions come from one game.
+
+  void analyse(Position& pos, istringstream& is, StateListPtr& states) {
+
+    string inName, outName, token, limits;
+    bool keepHash = false;
+
+    is >> inName >> outName;
+
+    while (is >> token)
+        if (token == "keephash" && limits.empty())
+            keepHash = true;
+        else
+            limits += token + " ";
+
+    ifstream inFile;
+    ofstream outFile;
+
+    if (inName != "-")
+        inFile.open(inName);
+
+    if (outName != "-")
+        outFile.open(outName);
+
+    if ((inName != "-" && !inFile.is_open()) || outName.empty() || (outName != "-" && !outFile.is_open()))
+    {
+        sync_cout << "info string Unable to open " << (inFile.is_open() ? outName : inName) << sync_endl;
+        return;
+    }
+
+    istream& in = inName == "-" ? cin : inFile;
+    string line;
+    size_t count = 0;
+    uint64_t nodes = 0;
+    TimePoint elapsed = now();
+
+    while (getline(in, line) && !(inName == "-" && line == "end"))
+    {
+        istringstream ss(line);
+        vector<string> fields;
+
+        while (ss >> token)
+            fields.push_back(token);
+
+        if (fields.size() < 4 || (fields[1] != "w" && fields[1] != "b"))
+            continue;
+
+        // A FEN has the move counters after the 4 fields of an EPD position
+        size_t opsStart = 4;
+        string fen = fields[0] + " " + fields[1] + " " + fields[2] + " " + fields[3];
+
+        if (   fields.size() >= 6
+            && fields[4].find_first_not_of("0123456789") == string::npos
+            && fields[5].find_first_not_of("0123456789") == string::npos)
+        {
+            fen += " " + fields[4] + " " + fields[5];
+            opsStart = 6;
+        }
+
+        string ops;
+        for (size_t i = opsStart; i < fields.size(); ++i)
+            ops += fields[i] + " ";
+
+        if (!keepHash)
+            Search::clear();
+
+        TimePoint start = now();
+        const Thread* best = run_job(pos, "fen " + fen, limits, states, true);
+        const Search::RootMove& rm = best->rootMoves[0];
+        string id = epd_op(ops, "id"), bm = epd_op(ops, "bm");
+        stringstream json, pv;
+
+        for (size_t i = 0; i < rm.pv.size(); ++i)
+            pv << (i ? " " : "") << UCI::move(rm.pv[i], pos.is_chess960());
+
+        json << "{\"n\":" << ++count;
+
+        if (!id.empty())
+            json << ",\"id\":" << json_string(id);
+
+        json << ",\"fen\":" << json_string(pos.fen());
+
+        if (!bm.empty())
+            json << ",\"bm\":" << json_string(bm);
+
+        json << ",\"bestmove\":" << json_string(UCI::move(rm.pv[0], pos.is_chess960()))
+             << ",\"score\":" << json_string(UCI::value(job_score(best, pos)))
+             << ",\"depth\":" << best->completedDepth / ONE_PLY
+             << ",\"seldepth\":" << rm.selDepth
+             << ",\"nodes\":" << Threads.nodes_searched()
+             << ",\"time_ms\":" << now() - start
+             << ",\"pv\":" << json_string(pv.str()) << "}";
+
+        if (outName == "-")
+            sync_cout << json.str() << sync_endl;
+        else
+            outFile << json.str() << endl;
+
+        nodes += Threads.nodes_searched();
+    }
+
+    elapsed = now() - elapsed + 1;
+
+    sync_cout << "info string analyse " << count << " positions"
+              << " nodes " << nodes
+              << " time " << elapsed
+              << " nps " << 1000 * nodes / elapsed << sync_endl;
+  }
+
+
+  // tt_command() is called when engine receives the "tt" debug command. The
+  // only subcommand is "stats", which reports on the transposition table.
+
+  void tt_command(istringstream& is, const string& cmd) {
+
+    string token;
+    is >> token;
+
+    if (token == "stats")
+    {
+        TT.allocate();
+        sync_cout << TT.stats() << sync_endl;
+    }
+    else
+        sync_cout << "Unknown command: " << cmd << sync_endl;
+  }
+
 } // namespace
 
 
@@ -191,7 +600,7 @@ void UCI::loop(int argc, char* argv[]) {
   Position pos;
   string token, cmd;
   StateListPtr states(new std::deque<StateInfo>(1));
-  auto uiThread = std::make_shared<Thread>(0);
+  auto uiThread = std::make_shared<Thread>(0, 0); // Not part of the pool
 
   pos.set(StartFEN, false, &states->back(), uiThread.get());
 
@@ -207,6 +616,10 @@ void UCI::loop(int argc, char* argv[]) {
       token.clear(); // Avoid a stale if getline() returns empty or blank line
       is >> skipws >> token;
 
+      // Any command but "isready" ends the warm-up after a book move
+      if (token != "isready")
+          Threads.stop_warmup();
+
       // The GUI sends 'ponderhit' to tell us the user has played the expected move.
       // So 'ponderhit' will be sent if we were told to ponder on the same move the
       // user has played. We should continue searching but switch from pondering to
@@ -215,10 +628,16 @@ void UCI::loop(int argc, char* argv[]) {
       if (    token == "quit"
           ||  token == "stop"
           || (token == "ponderhit" && Threads.stopOnPonderhit))
+      {
           Threads.stop = true;
+          Threads.notify_stop();
+      }
 
       else if (token == "ponderhit")
+      {
           Threads.ponder = false; // Switch to normal search
+          Threads.notify_stop();
+      }
 
       else if (token == "uci")
           sync_cout << "id name " << engine_info(true)
@@ -241,13 +660,27 @@ void UCI::loop(int argc, char* argv[]) {
 		  if (Options["Clear Search"])
 			  Search::clear();
 	  }
-      else if (token == "ucinewgame") Search::clear();
-      else if (token == "isready")    sync_cout << "readyok" << sync_endl;
+      else if (token == "ucinewgame")
+      {
+          Learning.save();
+          Search::clear();
+      }
+      else if (token == "isready")
+      {
+          TT.allocate(); // Deferred at startup, see main()
+          sync_cout << "readyok" << sync_endl;
+      }
 
       // Additional custom non-UCI commands, mainly for debugging
       else if (token == "flip")  pos.flip();
       else if (token == "bench") bench(pos, is, states);
+      else if (token == "batch") batch(pos, is, states);
+      else if (token == "analyse") analyse(pos, is, states);
+      else if (token == "benchjson")  bench_json(pos, is, states);
+      else if (token == "microbench") microbench(is);
       else if (token == "d")     sync_cout << pos << sync_endl;
+      else if (token == "tt")    tt_command(is, cmd);
+      else if (token == "stats") sync_cout << Threads.stats_json() << sync_endl;
       else if (token == "eval")  sync_cout << Eval::trace(pos) << sync_endl;
       else
           sync_cout << "Unknown command: " << cmd << sync_endl;
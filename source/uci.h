@@ -83,6 +83,9 @@ std::string move(Move m, bool chess960);
 std::string pv(const Position& pos, Depth depth, Value alpha, Value beta);
 Move to_move(const Position& pos, std::string& str);
 
+extern int64_t StartupTime; // In ms, from the start of main() to the UCI loop, without
+                            // the TT allocation, deferred to the first "isready" or "go"
+
 } // namespace UCI
 
 extern UCI::OptionsMap Options;
@@ -33,6 +33,7 @@
 #include "uci.h"
 #include "syzygy/tbprobe.h"
 #include "polybook.h"
+#include "learn.h"
 
 using std::string;
 
@@ -43,9 +44,10 @@ namespace UCI {
 /// 'On change' actions, triggered by an option's value change
 void on_clear_hash(const Option&) { Search::clear(); }
 void on_hash_size(const Option& o) { TT.resize(o); }
-void on_large_pages(const Option& o) { TT.resize(o); }  // warning is ok, will be removed
+void on_large_pages(const Option&) { TT.resize(0); } // Same size, new allocation
 void on_logger(const Option& o) { start_logger(o); }
 void on_threads(const Option& o) { Threads.set(o); }
+void on_thread_binding(const Option& o) { Numa::init(o); Threads.set(Options["Threads"]); }
 void on_tb_path(const Option& o) { Tablebases::init(o); }
 //Hash	
 void on_HashFile(const Option& o) { TT.set_hash_file_name(o); }
@@ -53,9 +55,9 @@ void SaveHashtoFile(const Option&) { TT.save(); }
 void LoadHashfromFile(const Option&) { TT.load(); }
 void LoadEpdToHash(const Option&) { TT.load_epd_to_hash(); }
 //end_Hash
+void on_learning(const Option&) { Learning.init(); }
 
-void on_book_file(const Option& o) { polybook.init(o); }
-void on_best_book_move(const Option& o) { polybook.set_best_book_move(o); }
+void on_book(const Option&) { polybook.init(); }
 void on_book_depth(const Option& o) { polybook.set_book_depth(o); }
 
 /// Our case insensitive less() function as required by UCI protocol
@@ -80,17 +82,32 @@ void init(OptionsMap& o) {
   o["Contempt"]              << Option(21, -100, 100);
   o["Analysis Contempt"]     << Option("Both var Off var White var Black var Both", "Both");
   o["Threads"]               << Option(n, unsigned(1), unsigned(512), on_threads);
+  o["Thread Binding"]        << Option("auto", on_thread_binding);
+  o["SMP Policy"]            << Option("Skip Blocks var Skip Blocks var Depth Offset var Aspiration", "Skip Blocks");
+  o["SMP Report"]            << Option(false);
+  o["Info Lines Per Second"] << Option(0, 0, 1000);
   o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
+  o["Eval Cache"]            << Option(0, 0, 64);
+  o["Pawn Hash"]             << Option(2048, 1, 65536);
+  o["Material Hash"]         << Option(512, 1, 65536);
   o["Clear_Hash"]            << Option(on_clear_hash);
   o["Ponder"]                << Option(false);
-  o["OwnBook"]               << Option(false);
-  o["Book File"]             << Option("book.bin");
-  o["Best Book Move"]        << Option(false);
+  o["OwnBook"]               << Option(false, on_book);
+  o["Book File"]             << Option("book.bin", on_book);
+  o["Best Book Move"]        << Option(false, on_book);
+  o["Book Priority"]         << Option(1, 0, 10, on_book);
+  o["Book Warmup Depth"]     << Option(0, 0, 30);
   o["MultiPV"]               << Option(1, 1, 500);
+  o["MultiPV Null Window"]   << Option(false);
   o["Skill Level"]           << Option(20, 0, 20);
   o["Move Overhead"]         << Option(30, 0, 5000);
   o["Minimum Thinking Time"] << Option(20, 0, 5000);
   o["Slow Mover"]            << Option(84, 10, 1000);
+  o["Time Policy"]           << Option("Classic var Classic var Adaptive", "Classic");
+  o["Time Log"]              << Option("");
+  o["Search Reuse"]          << Option(false);
+  o["Deterministic SMP"]     << Option(false);
+  o["Lazy Quiet Depth"]      << Option(0, 0, 20);
   o["nodestime"]             << Option(0, 0, 10000);
   o["UCI_Chess960"]          << Option(false);
   o["Junior Depth"]			 << Option(MAX_PLY-1, 1, MAX_PLY-1);
@@ -100,25 +117,30 @@ void init(OptionsMap& o) {
   o["Junior Passed"]		 << Option(true);
   o["Junior Space"]			 << Option(true);
   o["Junior Initiative"]	 << Option(true);
-  o["Shashin Strategy"]		 << Option(true);
   o["NeverClearHash"]        << Option(false);
   o["HashFile"]              << Option("hash.hsh", on_HashFile);
+  o["HashFileCompress"]      << Option(true);
+  o["TT Stats"]              << Option(false);
   o["SaveHashtoFile"]        << Option(SaveHashtoFile);
   o["LoadHashfromFile"]      << Option(LoadHashfromFile);
   o["LoadEpdToHash"]         << Option(LoadEpdToHash);
+  o["Learning"]              << Option(false, on_learning);
+  o["LearningFile"]          << Option("learn.bin", on_learning);
   o["UCI_AnalyseMode"]       << Option(false);
   o["SyzygyPath"]            << Option("<empty>", on_tb_path);
   o["SyzygyProbeDepth"]      << Option(1, 1, 100);
   o["Syzygy50MoveRule"]      << Option(true);
   o["SyzygyProbeLimit"]      << Option(7, 0, 7);
+  o["SyzygyPrefetch"]        << Option(false);
   o["Large Pages"]           << Option(true, on_large_pages);
   o["Tactical Mode"]         << Option(0, 0,  8);
   o["Clear Search"]          << Option(false);
   o["NullMove"]              << Option(true);
   o["Variety"]               << Option (0, 0, 40);
-  o["Book_Enabled"]          << Option(true);
-  o["BookFile"]              << Option("Cerebellum_Light_Poly.bin", on_book_file);
-  o["BestBookMove"]          << Option(true, on_best_book_move);
+  o["Book_Enabled"]          << Option(true, on_book);
+  o["BookFile"]              << Option("Cerebellum_Light_Poly.bin", on_book);
+  o["BestBookMove"]          << Option(true, on_book);
+  o["BookPriority"]          << Option(1, 0, 10, on_book);
   o["BookDepth"]             << Option(255, 1, 255, on_book_depth);
 }
 
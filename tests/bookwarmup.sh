@@ -0,0 +1,71 @@
+#!/bin/bash
+# verify that the engine stays responsive while it warms the TT up after a
+# book move, also with the deterministic SMP mode
+
+error()
+{
+  echo "bookwarmup testing failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+echo "bookwarmup testing started"
+
+# a polyglot book with a single entry: 1.e4 from the start position
+printf '\x46\x3b\x96\x18\x16\x91\xfc\x9c\x03\x1c\x00\x01\x00\x00\x00\x00' > warmup.bin
+
+cat << EOF > warmup.exp
+ set timeout 10
+ spawn ./stockfish
+ lassign \$argv threads deterministic
+
+ send "uci\n"
+ expect "uciok"
+
+ send "setoption name Threads value \$threads\n"
+ send "setoption name Deterministic SMP value \$deterministic\n"
+ send "setoption name OwnBook value true\n"
+ send "setoption name Book File value warmup.bin\n"
+ send "setoption name Book Warmup Depth value 12\n"
+
+ send "ucinewgame\n"
+ send "position startpos\n"
+ send "go wtime 10000 btime 10000\n"
+ expect {
+   "bestmove e2e4" {}
+   timeout {exit 1}
+ }
+
+ send "isready\n"
+ expect {
+   "readyok" {}
+   timeout {exit 1}
+ }
+
+ send "position startpos moves e2e4 e7e5\n"
+ send "go wtime 10000 btime 10000 movetime 200\n"
+ expect {
+   "bestmove" {}
+   timeout {exit 1}
+ }
+
+ send "quit\n"
+ expect eof
+
+ # return error code of the spawned program, useful for valgrind
+ lassign [wait] pid spawnid os_error value
+ exit \$value
+EOF
+
+for threads in 1 4
+do
+  for deterministic in false true
+  do
+    echo "bookwarmup testing with $threads threads, deterministic SMP $deterministic"
+    expect warmup.exp $threads $deterministic > /dev/null
+  done
+done
+
+rm warmup.exp warmup.bin
+
+echo "bookwarmup testing OK"
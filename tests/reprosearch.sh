@@ -12,15 +12,19 @@ echo "reprosearch testing started"
 
 # repeat two short games, separated by ucinewgame. 
 # with go nodes $nodes they should result in exactly
-# the same node count for each iteration.
+# the same node count for each iteration. With more
+# than one thread, the deterministic SMP mode is used.
 cat << EOF > repeat.exp
  set timeout 10
  spawn ./stockfish
- lassign \$argv nodes
+ lassign \$argv nodes threads
 
  send "uci\n"
  expect "uciok"
 
+ send "setoption name Threads value \$threads\n"
+ send "setoption name Deterministic SMP value true\n"
+
  send "ucinewgame\n"
  send "position startpos\n"
  send "go nodes \$nodes\n"
@@ -49,10 +53,13 @@ for i in `seq 1 20`
 do
 
   nodes=$((100*3**i/2**i))
-  echo "reprosearch testing with $nodes nodes"
+  for threads in 1 4
+  do
+    echo "reprosearch testing with $nodes nodes and $threads threads"
 
-  # each line should appear exactly an even number of times
-  expect repeat.exp $nodes 2>&1 | grep -o "nodes [0-9]*" | sort | uniq -c | awk '{if ($1%2!=0) exit(1)}'
+    # each line should appear exactly an even number of times
+    expect repeat.exp $nodes $threads 2>&1 | grep -o "nodes [0-9]*" | sort | uniq -c | awk '{if ($1%2!=0) exit(1)}'
+  done
 
 done
 